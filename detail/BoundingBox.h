@@ -0,0 +1,177 @@
+#ifndef CPPTEX_BOUNDINGBOX_H
+#define CPPTEX_BOUNDINGBOX_H
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "parallel.h"
+
+namespace cpptex {
+
+/**
+ * The axis-aligned extent of a point set. Points with a NaN or infinite coordinate are counted
+ * but left out. A box computed once can be passed to the autoscale of every figure of the same
+ * point set, instead of scanning the points again for each one.
+ */
+struct BoundingBox {
+    double minX = std::numeric_limits<double>::infinity();
+    double minY = std::numeric_limits<double>::infinity();
+    double maxX = -std::numeric_limits<double>::infinity();
+    double maxY = -std::numeric_limits<double>::infinity();
+    size_t count = 0;     // points inside the box
+    size_t nonFinite = 0; // points left out
+
+    bool empty() const {
+        return count == 0;
+    }
+    double width() const {
+        return empty() ? 0 : maxX - minX;
+    }
+    double height() const {
+        return empty() ? 0 : maxY - minY;
+    }
+
+    void add(double x, double y) {
+        if(!std::isfinite(x) || !std::isfinite(y)) {
+            ++nonFinite;
+            return;
+        }
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+        ++count;
+    }
+    void merge(const BoundingBox& other) {
+        minX = std::min(minX, other.minX);
+        minY = std::min(minY, other.minY);
+        maxX = std::max(maxX, other.maxX);
+        maxY = std::max(maxY, other.maxY);
+        count += other.count;
+        nonFinite += other.nonFinite;
+    }
+    /** The box grown by marginX and marginY on each side; an empty box stays empty. */
+    BoundingBox padded(double marginX, double marginY) const {
+        BoundingBox box = *this;
+        if(!empty()) {
+            box.minX -= marginX;
+            box.minY -= marginY;
+            box.maxX += marginX;
+            box.maxY += marginY;
+        }
+        return box;
+    }
+    BoundingBox padded(double margin) const {
+        return padded(margin, margin);
+    }
+
+    /** The box of the points (x[i],y[i]) for i < n, reduced on up to maxThreads threads. */
+    template<class Coordinate>
+    static BoundingBox ofArrays(const Coordinate* x, const Coordinate* y, size_t n, unsigned maxThreads = 0) {
+        static_assert(std::is_arithmetic<Coordinate>::value, "coordinates must be arithmetic");
+        std::vector<BoundingBox> partial(parallelChunkCount(n, maxThreads, MinChunk));
+        parallelFor(n, [&](size_t begin, size_t end, size_t chunk) {
+            partial[chunk] = reduce(begin, end, [x, y](size_t i, double& px, double& py) {
+                px = x[i];
+                py = y[i];
+            });
+        }, maxThreads, MinChunk);
+        return mergeAll(partial);
+    }
+    /** The box of the points in [begin,end), which have x() and y(). Random-access ranges are split over threads. */
+    template<class Iterator>
+    static BoundingBox of(Iterator begin, Iterator end, unsigned maxThreads = 0) {
+        typedef typename std::iterator_traits<Iterator>::iterator_category Category;
+        if constexpr(std::is_base_of<std::random_access_iterator_tag, Category>::value) {
+            size_t n = end - begin;
+            std::vector<BoundingBox> partial(parallelChunkCount(n, maxThreads, MinChunk));
+            parallelFor(n, [&](size_t first, size_t last, size_t chunk) {
+                partial[chunk] = reduce(first, last, [begin](size_t i, double& px, double& py) {
+                    auto p = begin + i;
+                    px = p->x();
+                    py = p->y();
+                });
+            }, maxThreads, MinChunk);
+            return mergeAll(partial);
+        } else {
+            BoundingBox box;
+            for(auto p = begin; p != end; ++p)
+                box.add(p->x(), p->y());
+            return box;
+        }
+    }
+
+private:
+    static constexpr size_t MinChunk = 1 << 16;
+    static constexpr size_t Lanes = 8;
+
+    static BoundingBox mergeAll(const std::vector<BoundingBox>& boxes) {
+        BoundingBox box;
+        for(const auto& partial : boxes)
+            box.merge(partial);
+        return box;
+    }
+    /**
+     * Reduce the points get(i, x, y) for i in [first,last) in independent lanes, which the
+     * compiler turns into packed min and max instructions for contiguous coordinates. A NaN never
+     * enters a lane since it compares false, and x*0 is 0 unless x is NaN or infinite; if any
+     * coordinate is not finite, the range is reduced again point by point.
+     */
+    template<class GetPoint>
+    static BoundingBox reduce(size_t first, size_t last, GetPoint get) {
+        const double inf = std::numeric_limits<double>::infinity();
+        double minX[Lanes], minY[Lanes], maxX[Lanes], maxY[Lanes], finite[Lanes];
+        std::fill(minX, minX + Lanes, inf);
+        std::fill(minY, minY + Lanes, inf);
+        std::fill(maxX, maxX + Lanes, -inf);
+        std::fill(maxY, maxY + Lanes, -inf);
+        std::fill(finite, finite + Lanes, 0.0);
+
+        auto update = [&](size_t k, double px, double py) {
+            minX[k] = px < minX[k] ? px : minX[k];
+            minY[k] = py < minY[k] ? py : minY[k];
+            maxX[k] = px > maxX[k] ? px : maxX[k];
+            maxY[k] = py > maxY[k] ? py : maxY[k];
+            finite[k] += px * 0.0 + py * 0.0;
+        };
+        size_t i = first;
+        for(; i + Lanes <= last; i += Lanes) {
+            for(size_t k=0; k<Lanes; ++k) {
+                double px, py;
+                get(i+k, px, py);
+                update(k, px, py);
+            }
+        }
+        for(; i < last; ++i) {
+            double px, py;
+            get(i, px, py);
+            update(0, px, py);
+        }
+
+        BoundingBox box;
+        if(std::any_of(finite, finite + Lanes, [](double f) { return f != 0.0; })) {
+            for(i = first; i < last; ++i) {
+                double px, py;
+                get(i, px, py);
+                box.add(px, py);
+            }
+            return box;
+        }
+        for(size_t k=0; k<Lanes; ++k) {
+            box.minX = std::min(box.minX, minX[k]);
+            box.minY = std::min(box.minY, minY[k]);
+            box.maxX = std::max(box.maxX, maxX[k]);
+            box.maxY = std::max(box.maxY, maxY[k]);
+        }
+        box.count = last - first;
+        return box;
+    }
+}; // struct BoundingBox
+
+} // namespace cpptex
+
+#endif // CPPTEX_BOUNDINGBOX_H
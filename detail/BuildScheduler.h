@@ -0,0 +1,288 @@
+#ifndef CPPTEX_BUILDSCHEDULER_H
+#define CPPTEX_BUILDSCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace cpptex {
+
+/** How a child process ended. */
+struct ProcessResult {
+    int exitStatus = -1; // -1 if the process could not be started, did not exit normally or timed out
+    double seconds = 0;
+    long peakMemoryKb = 0;
+    bool timedOut = false;
+};
+
+/** Environment variables to set for a child process, as name and value. */
+typedef std::vector<std::pair<std::string,std::string>> Environment;
+
+/**
+ * A process started with fork/exec. Its stdin reads /dev/null, so a compiler waiting for input
+ * stops instead of hanging, and stdout and stderr go to logPath. It inherits the environment of
+ * this process, with the variables of environment set on top. A process still running after
+ * timeoutSeconds is killed once it is polled or waited for; 0 never times out.
+ */
+class ChildProcess {
+public:
+    ChildProcess(const std::vector<std::string>& command, const std::string& logPath = "/dev/null",
+                 double timeoutSeconds = 0, const Environment& environment = {})
+        : m_start(std::chrono::steady_clock::now()), m_timeoutSeconds(timeoutSeconds) {
+        std::vector<char*> argv;
+        for(const auto& arg : command)
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        // build the environment before forking, since the child may only make async-signal-safe calls
+        std::vector<std::string> variables;
+        std::vector<char*> envp;
+        if(!environment.empty()) {
+            for(char** variable = environ; *variable != nullptr; ++variable) {
+                std::string entry = *variable;
+                bool overridden = std::any_of(environment.begin(), environment.end(), [&](const std::pair<std::string,std::string>& v) {
+                    return entry.compare(0, v.first.size() + 1, v.first + "=") == 0;
+                });
+                if(!overridden)
+                    variables.push_back(entry);
+            }
+            for(const auto& v : environment)
+                variables.push_back(v.first + "=" + v.second);
+            for(auto& variable : variables)
+                envp.push_back(&variable[0]);
+            envp.push_back(nullptr);
+        }
+
+        m_pid = fork();
+        if(m_pid == 0) {
+            int in = open("/dev/null", O_RDONLY);
+            int out = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(in >= 0)
+                dup2(in, STDIN_FILENO);
+            if(out >= 0) {
+                dup2(out, STDOUT_FILENO);
+                dup2(out, STDERR_FILENO);
+            }
+            if(!environment.empty())
+                environ = envp.data();
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        m_finished = m_pid < 0;
+    }
+
+    /** Reap the process if it has exited, or kill it if it ran out of time. Returns whether it has finished. */
+    bool poll() {
+        if(!m_finished)
+            reap(WNOHANG);
+        if(!m_finished && m_timeoutSeconds > 0
+                && std::chrono::steady_clock::now() - m_start > std::chrono::duration<double>(m_timeoutSeconds)) {
+            kill(m_pid, SIGKILL);
+            m_result.timedOut = true;
+            reap(0);
+        }
+        return m_finished;
+    }
+    const ProcessResult& wait() {
+        if(m_timeoutSeconds > 0) {
+            while(!poll())
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        } else if(!m_finished) {
+            reap(0);
+        }
+        return m_result;
+    }
+    const ProcessResult& result() const {
+        return m_result;
+    }
+
+private:
+    pid_t m_pid;
+    bool m_finished = false;
+    std::chrono::steady_clock::time_point m_start;
+    double m_timeoutSeconds;
+    ProcessResult m_result;
+
+    void reap(int options) {
+        int status = 0;
+        struct rusage usage{};
+        pid_t reaped = wait4(m_pid, &status, options, &usage);
+        if(reaped == 0)
+            return; // still running
+        m_finished = true;
+        m_result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        if(reaped == m_pid) {
+            m_result.exitStatus = WIFEXITED(status) && !m_result.timedOut ? WEXITSTATUS(status) : -1;
+            m_result.peakMemoryKb = usage.ru_maxrss;
+        }
+    }
+};
+
+/** Run a process to completion, or until it times out. */
+inline ProcessResult runProcess(const std::vector<std::string>& command, const std::string& logPath = "/dev/null",
+                         double timeoutSeconds = 0, const Environment& environment = {}) {
+    return ChildProcess(command, logPath, timeoutSeconds, environment).wait();
+}
+
+/**
+ * Runs a DAG of build jobs, such as the compilation of precompiled subdocuments, with at most
+ * maxWorkers processes at a time. A job starts once all of its dependencies succeeded; jobs
+ * depending on a failed job are skipped. A failed job is run again as long as its retry hook
+ * adjusts it and returns true.
+ */
+class BuildScheduler {
+public:
+    typedef size_t JobId;
+
+    struct Job {
+        std::string name;
+        std::vector<std::string> command;
+        std::vector<JobId> dependencies;
+        std::function<void(const ProcessResult&)> onFinish; // called on the scheduling thread
+        std::function<bool()> isUpToDate; // checked once the dependencies are built; true skips the job
+        double timeoutSeconds = 0; // per run, 0 for none
+        Environment environment;
+        std::function<bool(Job&, const ProcessResult&)> retry; // called on the scheduling thread after a failed run
+    };
+    struct JobResult {
+        std::string name;
+        ProcessResult process; // of the last run
+        bool skipped = false;
+        bool upToDate = false;
+        size_t runs = 0;
+    };
+
+    explicit BuildScheduler(unsigned maxWorkers = 0)
+        : m_maxWorkers(maxWorkers > 0 ? maxWorkers : std::max(1u, std::thread::hardware_concurrency())) {}
+
+    /** Add a job; dependencies must refer to jobs added before it. */
+    JobId addJob(Job job) {
+        for(JobId dependency : job.dependencies) {
+            if(dependency >= m_jobs.size())
+                throw std::invalid_argument("addJob: " + job.name + " depends on an unknown job");
+        }
+        m_jobs.push_back(std::move(job));
+        return m_jobs.size() - 1;
+    }
+    bool empty() const {
+        return m_jobs.empty();
+    }
+
+    /** Run every job and wait for all of them. Results are in the order the jobs were added. */
+    std::vector<JobResult> run() {
+        enum State { Waiting, Running, Succeeded, Failed };
+        std::vector<State> state(m_jobs.size(), Waiting);
+        std::vector<JobResult> results(m_jobs.size());
+        std::vector<bool> checked(m_jobs.size(), false); // whether isUpToDate was asked
+        std::vector<std::pair<JobId,ChildProcess>> running;
+        size_t done = 0;
+
+        while(done < m_jobs.size()) {
+            // settle jobs whose dependencies failed, and start ready ones while workers are free
+            for(JobId id=0; id<m_jobs.size(); ++id) {
+                if(state[id] != Waiting)
+                    continue;
+                const auto& dependencies = m_jobs[id].dependencies;
+                bool failed = std::any_of(dependencies.begin(), dependencies.end(), [&](JobId d){ return state[d] == Failed; });
+                bool ready = std::all_of(dependencies.begin(), dependencies.end(), [&](JobId d){ return state[d] == Succeeded; });
+                if(failed) {
+                    state[id] = Failed;
+                    results[id].name = m_jobs[id].name;
+                    results[id].skipped = true;
+                    ++done;
+                    continue;
+                }
+                if(!ready)
+                    continue;
+                if(!checked[id]) {
+                    checked[id] = true;
+                    if(m_jobs[id].isUpToDate && m_jobs[id].isUpToDate()) {
+                        state[id] = Succeeded;
+                        results[id].name = m_jobs[id].name;
+                        results[id].process.exitStatus = 0;
+                        results[id].upToDate = true;
+                        ++done;
+                        continue;
+                    }
+                }
+                if(running.size() < m_maxWorkers) {
+                    const Job& job = m_jobs[id];
+                    state[id] = Running;
+                    ++results[id].runs;
+                    running.emplace_back(id, ChildProcess(job.command, "/dev/null", job.timeoutSeconds, job.environment));
+                }
+            }
+            // reap finished jobs
+            bool progress = false;
+            for(auto it=running.begin(); it!=running.end(); ) {
+                if(it->second.poll()) {
+                    JobId id = it->first;
+                    results[id].name = m_jobs[id].name;
+                    results[id].process = it->second.result();
+                    progress = true;
+                    it = running.erase(it);
+                    if(results[id].process.exitStatus != 0 && m_jobs[id].retry && m_jobs[id].retry(m_jobs[id], results[id].process)) {
+                        state[id] = Waiting; // started again in the next round
+                        continue;
+                    }
+                    state[id] = results[id].process.exitStatus == 0 ? Succeeded : Failed;
+                    if(m_jobs[id].onFinish)
+                        m_jobs[id].onFinish(results[id].process);
+                    ++done;
+                } else {
+                    ++it;
+                }
+            }
+            if(!progress && !running.empty())
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        m_jobs.clear();
+        return results;
+    }
+
+    static void printReport(const std::vector<JobResult>& results, std::ostream& out = std::cout) {
+        std::ios::fmtflags flags(out.flags());
+        std::streamsize precision = out.precision();
+        for(const auto& result : results) {
+            out << "  " << result.name << ": ";
+            if(result.skipped) {
+                out << "skipped, a dependency failed\n";
+            } else if(result.upToDate) {
+                out << "up to date\n";
+            } else {
+                out << std::fixed << std::setprecision(2) << result.process.seconds << "s"
+                    << (result.runs > 1 ? " after " + std::to_string(result.runs) + " runs" : "")
+                    << (result.process.timedOut ? ", FAILED, timed out"
+                        : result.process.exitStatus == 0 ? "" : ", FAILED with status " + std::to_string(result.process.exitStatus))
+                    << "\n";
+            }
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    unsigned m_maxWorkers;
+    std::vector<Job> m_jobs;
+}; // class BuildScheduler
+
+} // namespace cpptex
+
+#endif // CPPTEX_BUILDSCHEDULER_H
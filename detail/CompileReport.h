@@ -0,0 +1,90 @@
+#ifndef CPPTEX_COMPILEREPORT_H
+#define CPPTEX_COMPILEREPORT_H
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BuildScheduler.h"
+
+namespace cpptex {
+
+/**
+ * How the compilation of a document went, from the compiler's exit status and its .log file.
+ * Errors are the "! " lines of the log, each followed by the "l.N" line telling where TeX was
+ * when it stopped, if there is one.
+ */
+struct CompileReport {
+    std::string engine;                      // compiler of the last run, such as pdflatex
+    ProcessResult process;                   // of the last run, exitStatus -1 if none ran
+    size_t attempts = 0;                     // runs, including retries after capacity failures
+    double seconds = 0;                      // of every run
+    bool upToDate = false;                   // the compiler was skipped by the cache
+    bool capacityExceeded = false;           // the last run hit a TeX memory limit
+    std::vector<std::string> errors;
+    std::vector<std::string> overfullBoxes;  // "Overfull \hbox" and "\vbox" warnings
+    long pages = -1;                         // of the PDF written, -1 if the log does not say
+    std::string logPath;
+
+    bool succeeded() const {
+        return upToDate || process.exitStatus == 0;
+    }
+
+    /** Read the errors, warnings and page count from a compiler log; a missing log gives an empty report. */
+    static CompileReport ofLog(const std::string& logPath) {
+        CompileReport report;
+        report.logPath = logPath;
+        std::ifstream in(logPath);
+        std::string log((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        std::vector<std::string> lines;
+        std::istringstream stream(log);
+        for(std::string line; std::getline(stream, line); ) {
+            if(!line.empty() && line.back() == '\r')
+                line.pop_back();
+            lines.push_back(line);
+        }
+        for(size_t i=0; i<lines.size(); ++i) {
+            const std::string& line = lines[i];
+            if(line.compare(0, 2, "! ") == 0) {
+                std::string error = line.substr(2);
+                if(error.compare(0, 21, "TeX capacity exceeded") == 0)
+                    report.capacityExceeded = true;
+                // the context lines end with the one giving the input line, shortly after
+                for(size_t j=i+1; j<lines.size() && j<=i+8 && lines[j].compare(0, 2, "! ") != 0; ++j) {
+                    if(lines[j].size() > 2 && lines[j].compare(0, 2, "l.") == 0 && std::isdigit(static_cast<unsigned char>(lines[j][2]))) {
+                        error += " " + lines[j];
+                        break;
+                    }
+                }
+                report.errors.push_back(error);
+            } else if(line.compare(0, 14, "Overfull \\hbox") == 0 || line.compare(0, 14, "Overfull \\vbox") == 0) {
+                report.overfullBoxes.push_back(line);
+            }
+        }
+
+        // TeX wraps long log lines, possibly inside the page count, so join the lines first
+        size_t output = log.find("Output written on ");
+        if(output != std::string::npos) {
+            std::string summary;
+            for(size_t i=output; i<log.size() && log[i] != ')'; ++i) {
+                if(log[i] != '\n' && log[i] != '\r')
+                    summary += log[i];
+            }
+            size_t count = summary.rfind(" (");
+            if(count != std::string::npos)
+                report.pages = std::strtol(summary.c_str() + count + 2, nullptr, 10);
+        } else if(log.find("No pages of output.") != std::string::npos) {
+            report.pages = 0;
+        }
+        return report;
+    }
+}; // struct CompileReport
+
+} // namespace cpptex
+
+#endif // CPPTEX_COMPILEREPORT_H
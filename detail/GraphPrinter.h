@@ -1,12 +1,25 @@
 #ifndef CPPTEX_GRAPHPRINTER_H
 #define CPPTEX_GRAPHPRINTER_H
 
+#include <cassert>
+#include <cctype>
+#include <cstdint>
 #include <iomanip>
+#include <iterator>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility> // pair
+#include <vector>
 
+#include "RasterCanvas.h"
+#include "SpatialGrid.h"
 #include "TikzPrinter.h"
+#include "parallel.h"
 #include "util.h"
 
 namespace cpptex {
@@ -28,51 +41,58 @@ public:
 
     OptionsList activeEdgeOptions = { // active edge options
             {"color",      activeEdgeColor},
-            {"line width", std::to_string(activeEdgeWidth)}
+            {"line width", formatNumber(activeEdgeWidth, {6})}
     };
     OptionsList inactiveEdgeOptions = { // active edge options
             {"color",      inactiveEdgeColor},
-            {"line width", std::to_string(inactiveEdgeWidth)}
+            {"line width", formatNumber(inactiveEdgeWidth, {6})}
     };
     OptionsList triangulationEdgeOptions = { // active edge options
             {"densely dashed", ""},
             {"color",      inactiveEdgeColor},
-            {"line width", std::to_string(inactiveEdgeWidth/2)}
+            {"line width", formatNumber(inactiveEdgeWidth/2, {6})}
     };
     OptionsList coneOptions = { // active edge options
             {"color",      activeEdgeColor},
-            {"line width", std::to_string(inactiveEdgeWidth/3)},
+            {"line width", formatNumber(inactiveEdgeWidth/3, {6})},
             {"densely dotted",  ""}
     };
     OptionsList highlightEdgeOptions = { // active edge options
             //{"densely dashed", ""},
             {"color",          worstPathEdgeColor},
-            {"line width",     std::to_string(activeEdgeWidth)}
+            {"line width",     formatNumber(activeEdgeWidth, {6})}
     };
     OptionsList highlightVertexOptions = {
             {"diamond",    ""},
-            {"vertex",     (std::to_string(vertexRadius * 1.61))}, // vertex width
+            {"vertex",     (formatNumber(vertexRadius * 1.61, {6}))}, // vertex width
             {"color",      (worstPathEdgeColor)}, // text color
             {"fill",       (worstPathEdgeColor)}, // vertex color
-            {"line width", (std::to_string(0))} // vertex border (same color as text)
+            {"line width", (formatNumber(0))} // vertex border (same color as text)
     };
     OptionsList activeVertexOptions = {
             {"circle",     ""},
-            {"vertex",     (std::to_string(vertexRadius))}, // vertex width
+            {"vertex",     (formatNumber(vertexRadius, {6}))}, // vertex width
             {"color",      (backgroundColor)}, // text color
             {"fill",       (activeVertexColor)}, // vertex color
-            {"line width", (std::to_string(0))} // vertex border (same color as text)
+            {"line width", (formatNumber(0))} // vertex border (same color as text)
     };
     OptionsList borderOptions = {
-            {"border",     (std::to_string(vertexRadius))}, // choose shape of vertex
+            {"border",     (formatNumber(vertexRadius, {6}))}, // choose shape of vertex
             {"color",      activeEdgeColor}, // additional border color
-            {"line width", std::to_string(inactiveEdgeWidth)}, // additional border width
+            {"line width", formatNumber(inactiveEdgeWidth, {6})}, // additional border width
     };
 
     template< class InputIterator>
     explicit GraphPrinter(std::string path, InputIterator pointsBegin, InputIterator pointsEnd, double sizeInCm = 10.0, std::string documentType = "standalone")
+            : GraphPrinter(path, BoundingBox::of(pointsBegin, pointsEnd), sizeInCm, documentType) {}
+
+    /** A printer scaled to bounds, e.g. a box shared by several figures of the same point set. */
+    explicit GraphPrinter(std::string path, const BoundingBox& bounds, double sizeInCm = 10.0, std::string documentType = "standalone")
             : TikzPrinter(path, documentType) {
 
+        // coordinates are in cm, so four decimals are well below what is visible
+        m_numberFormat.precision = 4;
+
         // setup graph environment
         std::string tikzOptions = getTikzOptions();
         //cout<<tikzOptions<<endl;
@@ -92,22 +112,100 @@ public:
         defineColor(inactiveVertexColor);
         defineColor(backgroundColor);
 
-        autoscale(pointsBegin, pointsEnd, sizeInCm);
+        // register the standard styles up front so they are defined once in the header
+        for( const auto& options : { activeEdgeOptions, inactiveEdgeOptions, triangulationEdgeOptions,
+                                     coneOptions, highlightEdgeOptions, highlightVertexOptions,
+                                     activeVertexOptions, borderOptions } )
+            internStyle(options);
+
+        autoscale(bounds, sizeInCm);
     }
 
     std::string getTikzOptions() {
         return std::string("vertex/.style = {circle,fill, minimum size=")
-               + std::to_string(vertexRadius)
+               + formatNumber(vertexRadius)
                + "cm, inner sep=0pt, outer sep=0pt}, "
                + "vertex/.default = 6pt, font=\\tiny";
     }
 
+    /**
+     * Threads used to format the primitives of bulk draw calls; 0 uses every core and 1 formats
+     * on the calling thread. The output does not depend on it.
+     */
+    unsigned m_drawThreads = 0;
+
     template< typename RandomAccessIterator, typename PointContainer >
     void drawEdges( RandomAccessIterator edgesBegin, RandomAccessIterator edgesEnd, const PointContainer &P, const OptionsList& options = {} ) {
-        for( auto e=edgesBegin; e!=edgesEnd; ++e ) {
-            drawEdge(P[e->first], P[e->second], options);
+        emitLines( edgesEnd - edgesBegin, [&]( size_t i, double& x1, double& y1, double& x2, double& y2 ) {
+            const auto& e = edgesBegin[i];
+            x1 = P[e.first].x() * getScaleX();
+            y1 = P[e.first].y() * getScaleY();
+            x2 = P[e.second].x() * getScaleX();
+            y2 = P[e.second].y() * getScaleY();
+        }, options );
+    }
+    /**
+     * Draw the edges that edgeIndex, built by SpatialGrid::ofEdges from the same edges and
+     * points, finds in the viewport, without visiting the others. Without a viewport every edge
+     * is drawn.
+     */
+    template< typename RandomAccessIterator, typename PointContainer >
+    void drawEdges( RandomAccessIterator edgesBegin, RandomAccessIterator edgesEnd, const PointContainer &P, const SpatialGrid& edgeIndex, const OptionsList& options = {} ) {
+        assert( edgeIndex.size() == static_cast<size_t>(edgesEnd - edgesBegin) );
+        GenerationTimer timer( *this );
+        if( m_viewport.empty() ) {
+            drawEdges( edgesBegin, edgesEnd, P, options );
+            return;
         }
+        std::vector<size_t> visible = edgeIndex.query( m_viewport );
+        emitLines( visible.size(), [&]( size_t i, double& x1, double& y1, double& x2, double& y2 ) {
+            const auto& e = edgesBegin[visible[i]];
+            x1 = P[e.first].x() * getScaleX();
+            y1 = P[e.first].y() * getScaleY();
+            x2 = P[e.second].x() * getScaleX();
+            y2 = P[e.second].y() * getScaleY();
+        }, options );
     }
+    /**
+     * Draw edges between points given as arrays of coordinates. x and y hold numPoints floats or
+     * doubles, and endpoints holds the 2*numEdges point indices of the edges, one pair after the
+     * other. All coordinates are scaled in one pass before formatting, as in drawEdges.
+     */
+    template< typename Coordinate, typename Index >
+    void drawEdgeArrays( const Coordinate* x, const Coordinate* y, size_t numPoints,
+                         const Index* endpoints, size_t numEdges, const OptionsList& options = {} ) {
+        GenerationTimer timer( *this );
+        std::vector<double> scaledX, scaledY;
+        scaleCoordinates( x, numPoints, getScaleX(), scaledX );
+        scaleCoordinates( y, numPoints, getScaleY(), scaledY );
+        emitLines( numEdges, [&]( size_t i, double& x1, double& y1, double& x2, double& y2 ) {
+            size_t a = static_cast<size_t>(endpoints[2*i]), b = static_cast<size_t>(endpoints[2*i+1]);
+            assert( a < numPoints && b < numPoints );
+            x1 = scaledX[a];
+            y1 = scaledY[a];
+            x2 = scaledX[b];
+            y2 = scaledY[b];
+        }, options );
+    }
+    /** Draw numPoints vertices given as arrays of coordinates, labeled by their index if withLabels. */
+    template< typename Coordinate >
+    void drawVertexArrays( const Coordinate* x, const Coordinate* y, size_t numPoints,
+                           const OptionsList& options = {}, bool withLabels = false ) {
+        GenerationTimer timer( *this );
+        std::vector<double> scaledX, scaledY;
+        scaleCoordinates( x, numPoints, getScaleX(), scaledX );
+        scaleCoordinates( y, numPoints, getScaleY(), scaledY );
+        emitVertices( numPoints, [&]( size_t i, double& vx, double& vy, std::string& label ) {
+            vx = scaledX[i];
+            vy = scaledY[i];
+            if( withLabels ) {
+                label.clear();
+                appendNumber( label, i );
+            }
+        }, options, withLabels );
+        m_body.content += "\n";
+    }
+
     template< typename P>
     void drawEdge(const P& lhs, const P& rhs, const OptionsList& options = {} ) {
         drawLine( lhs.x(),
@@ -118,70 +216,124 @@ public:
 
     template< typename Triangulation >
     void drawEdges( const Triangulation& T, const OptionsList& options = {} ) {
+        GenerationTimer timer( *this );
+        std::vector<Segment> segments;
         for( auto eit = T.finite_edges_begin(); eit != T.finite_edges_end(); ++eit ) {
             auto e = *eit;
             double x1 = e.first->vertex( (e.second+1)%3 )->point().x();
             double y1 = e.first->vertex( (e.second+1)%3 )->point().y();
             double x2 = e.first->vertex( (e.second+2)%3 )->point().x();
             double y2 = e.first->vertex( (e.second+2)%3 )->point().y();
-            drawLine( x1,y1,x2,y2,options );
+            segments.push_back( Segment{ x1*getScaleX(), y1*getScaleY(), x2*getScaleX(), y2*getScaleY() } );
         }
+        emitSegments( segments, options );
         m_body.content += "\n";
     }
 
     template< typename Triangulation >
     void drawEdgesOfSDG( const Triangulation& T, const OptionsList& options = {} ) {
+        GenerationTimer timer( *this );
+        std::vector<Segment> segments;
         for( auto eit = T.finite_edges_begin(); eit != T.finite_edges_end(); ++eit ) {
             auto e = *eit;
             double x1 = e.first->vertex( (e.second+1)%3 )->site().point().x();
             double y1 = e.first->vertex( (e.second+1)%3 )->site().point().y();
             double x2 = e.first->vertex( (e.second+2)%3 )->site().point().x();
             double y2 = e.first->vertex( (e.second+2)%3 )->site().point().y();
-            drawLine( x1,y1,x2,y2,options );
+            segments.push_back( Segment{ x1*getScaleX(), y1*getScaleY(), x2*getScaleX(), y2*getScaleY() } );
         }
+        emitSegments( segments, options );
         m_body.content += "\n";
     }
 
 
     template< typename T >
     void drawVertices( const T &Triangulation, const OptionsList& options = {}, const OptionsList& borderOptions = {} ) {
+        GenerationTimer timer( *this );
+        std::vector<Point> points;
         for( typename T::Finite_vertices_iterator it = Triangulation.finite_vertices_begin(); it != Triangulation.finite_vertices_end(); ++it )
-            drawVertexWithLabel( it->point().x(), it->point().y(), "", options, borderOptions );
+            points.push_back( Point{ it->point().x()*getScaleX(), it->point().y()*getScaleY() } );
+        emitPoints( points, {}, options );
         m_body.content += "\n";
     }
 
     template< typename InputIterator >
     void drawVertices( const InputIterator &pointsStart, const InputIterator &pointsEnd, const OptionsList& options = {}, const OptionsList& borderOptions = {} ) {
-        size_t id = 0;
-        for( auto it=pointsStart; it!=pointsEnd; ++it )
-            drawVertexWithLabel( it->x(), it->y(), "", options, borderOptions );
+        GenerationTimer timer( *this );
+        if constexpr( isRandomAccess<InputIterator>() ) {
+            emitVertices( pointsEnd - pointsStart, [&]( size_t i, double& x, double& y, std::string& ) {
+                x = pointsStart[i].x() * getScaleX();
+                y = pointsStart[i].y() * getScaleY();
+            }, options, false );
+        } else {
+            for( auto it=pointsStart; it!=pointsEnd; ++it )
+                drawVertexWithLabel( it->x(), it->y(), "", options, borderOptions );
+        }
         m_body.content += "\n";
     }
 
+    /**
+     * Draw the points that pointIndex, built by SpatialGrid::ofPoints from the same points,
+     * finds in the viewport, like drawEdges with an edge index.
+     */
+    template< typename RandomAccessIterator >
+    void drawVertices( RandomAccessIterator pointsStart, RandomAccessIterator pointsEnd, const SpatialGrid& pointIndex, const OptionsList& options = {} ) {
+        drawIndexedVertices( pointsStart, pointsEnd, pointIndex, options, false );
+    }
+
     template< typename T >
     void drawVerticesWithInfo( const T &Triangulation, const OptionsList& options = {}, const OptionsList& borderOptions = {} ) {
-        for( typename T::Finite_vertices_iterator it = Triangulation.finite_vertices_begin(); it != Triangulation.finite_vertices_end(); ++it )
-            drawVertexWithLabel( it->point().x(), it->point().y(), to_string(it->info()), options, borderOptions );
+        GenerationTimer timer( *this );
+        std::vector<Point> points;
+        std::vector<std::string> labels;
+        for( typename T::Finite_vertices_iterator it = Triangulation.finite_vertices_begin(); it != Triangulation.finite_vertices_end(); ++it ) {
+            points.push_back( Point{ it->point().x()*getScaleX(), it->point().y()*getScaleY() } );
+            labels.push_back( to_string(it->info()) );
+        }
+        emitPoints( points, labels, options );
         m_body.content += "\n";
     }
 
     template< typename InputIterator >
     void drawVerticesWithInfo( const InputIterator &pointsStart, const InputIterator &pointsEnd, const OptionsList& options = {}, const OptionsList& borderOptions = {} ) {
-        size_t id = 0;
-        for( auto it=pointsStart; it!=pointsEnd; ++it )
-            drawVertexWithLabel( it->x(), it->y(), std::to_string(id++), options, borderOptions );
+        GenerationTimer timer( *this );
+        if constexpr( isRandomAccess<InputIterator>() ) {
+            emitVertices( pointsEnd - pointsStart, [&]( size_t i, double& x, double& y, std::string& label ) {
+                x = pointsStart[i].x() * getScaleX();
+                y = pointsStart[i].y() * getScaleY();
+                label.clear();
+                appendNumber( label, i );
+            }, options, true );
+        } else {
+            size_t id = 0;
+            for( auto it=pointsStart; it!=pointsEnd; ++it )
+                drawVertexWithLabel( it->x(), it->y(), std::to_string(id++), options, borderOptions );
+        }
         m_body.content += "\n";
     }
 
+    /** Draw the points pointIndex finds in the viewport, labeled by their index in the point set. */
+    template< typename RandomAccessIterator >
+    void drawVerticesWithInfo( RandomAccessIterator pointsStart, RandomAccessIterator pointsEnd, const SpatialGrid& pointIndex, const OptionsList& options = {} ) {
+        drawIndexedVertices( pointsStart, pointsEnd, pointIndex, options, true );
+    }
+
     template< typename T >
     void drawVerticesWithInfoSDG( const T &Triangulation, const OptionsList& options = {}, const OptionsList& borderOptions = {} ) {
-        for( typename T::Finite_vertices_iterator it = Triangulation.finite_vertices_begin(); it != Triangulation.finite_vertices_end(); ++it )
-            drawVertexWithLabel( it->site().point().x(), it->site().point().y(), to_string(it->storage_site().info()), options, borderOptions );
+        GenerationTimer timer( *this );
+        std::vector<Point> points;
+        std::vector<std::string> labels;
+        for( typename T::Finite_vertices_iterator it = Triangulation.finite_vertices_begin(); it != Triangulation.finite_vertices_end(); ++it ) {
+            points.push_back( Point{ it->site().point().x()*getScaleX(), it->site().point().y()*getScaleY() } );
+            labels.push_back( to_string(it->storage_site().info()) );
+        }
+        emitPoints( points, labels, options );
         m_body.content += "\n";
     }
 
     template< typename T >
     void drawVertexPair( const std::pair<typename T::Vertex_handle,typename T::Vertex_handle>& vertices, const OptionsList& options = {} ) {
+        GenerationTimer timer( *this );
         drawVertex( vertices.first->point().x(), vertices.first->point().y(), options );
         drawVertex( vertices.second->point().x(), vertices.second->point().y(), options );
     }
@@ -191,21 +343,8 @@ public:
     }
 
     void drawVertexWithLabel( double x, double y, const std::string &label, const OptionsList& options = {}, const OptionsList& borderOptions = {} ) {
-
-        if( label.empty() ){
-            std::stringstream stream;
-            stream << std::fixed << std::setprecision(2);
-            stream << x << "," << y;
-            //label = stream.str();
-        }
-        m_body.content += "\\node (vertex" + label + ") [fill,"
-                          + expandOptions( options )
-                          + "] at ("
-                          + std::to_string( x*_scaleFactor ) + ","
-                          + std::to_string( y*_scaleFactor )
-                          + ") {"
-                          + label
-                          + "};\n";
+        GenerationTimer timer( *this );
+        emitVertex( x*getScaleX(), y*getScaleY(), label, options );
     }
 //
 //    void drawEdges( const spanner::DelaunayGraph& DG, const OptionsList& options = {} ) {
@@ -253,6 +392,7 @@ public:
                x = xTranslated*sizingFactor + xCenter,
                y = yTranslated*sizingFactor + yCenter,
                theta = cpptex::PI / numCones;
+        GenerationTimer timer( *this );
 
         for( size_t i=0; i<numCones; ++i) {
             drawLine(x,y,xCenter,yCenter,options);
@@ -264,14 +404,1158 @@ public:
     }
 
     void drawLine( double x1, double y1, double x2, double y2, const OptionsList& options = {} ) {
-        m_body.content += "\\draw [" + expandOptions(options ) + "] ("
-                          + std::to_string(x1*_scaleFactor) + "," + std::to_string(y1*_scaleFactor) + ") -- ("
-                          + std::to_string(x2*_scaleFactor) + "," + std::to_string(y2*_scaleFactor) + ");\n";
+        GenerationTimer timer( *this );
+        emitLine( x1*getScaleX(), y1*getScaleY(), x2*getScaleX(), y2*getScaleY(), options );
     }
     std::string getTikzGrid() const {
         return "\\draw[step=1.0,black,thin,dotted] (-5.5,-5.5) grid (5.5,5.5);";
     }
+
+    /** Primitives dropped by level-of-detail simplification. */
+    struct LevelOfDetailStats {
+        size_t zeroLengthEdges = 0;
+        size_t duplicateEdges = 0;
+        size_t collapsedVertices = 0;
+
+        size_t removed() const {
+            return zeroLengthEdges + duplicateEdges + collapsedVertices;
+        }
+    };
+    /**
+     * Snap every coordinate to a grid of resolutionInCm in the output. Edges that become
+     * zero-length or repeat an edge of the same style are dropped, as are unlabeled vertices
+     * that land on an already drawn vertex of the same style. Duplicates are found in fixed
+     * tables of maxRemembered edges and vertices each, about 48 bytes per entry, so memory stays
+     * bounded when streaming; a duplicate whose entry was taken over by another primitive is
+     * drawn again, which only costs the bytes.
+     */
+    void enableLevelOfDetail(double resolutionInCm = 0.01, size_t maxRemembered = 1 << 20) {
+        assert(resolutionInCm > 0);
+        m_lodResolution = resolutionInCm;
+        m_lodEdges.reset(maxRemembered);
+        m_lodVertices.reset(maxRemembered);
+    }
+    void disableLevelOfDetail() {
+        m_lodResolution = 0;
+    }
+    const LevelOfDetailStats& getLevelOfDetailStats() const {
+        return m_lodStats;
+    }
+    /** Record the level-of-detail counts as a comment in the document. */
+    void addLevelOfDetailComment() {
+        addComment("level of detail: removed " + std::to_string(m_lodStats.removed()) + " primitives ("
+                   + std::to_string(m_lodStats.zeroLengthEdges) + " zero-length edges, "
+                   + std::to_string(m_lodStats.duplicateEdges) + " duplicate edges, "
+                   + std::to_string(m_lodStats.collapsedVertices) + " collapsed vertices)");
+    }
+    /**
+     * Join the edges of each bulk draw call that share an end point into polylines of at most
+     * maxSegments edges, drawn with one \\draw each, so TeX builds and strokes far fewer paths.
+     * Repeated edges of a call, in either direction, are drawn once. Polylines use round line
+     * joins where separate edges would have butt caps, and a dash pattern runs on along a
+     * polyline instead of restarting at every edge.
+     */
+    void enablePolylines(size_t maxSegments = 256) {
+        assert(maxSegments > 0);
+        m_polylineMaxSegments = maxSegments;
+    }
+    void disablePolylines() {
+        m_polylineMaxSegments = 0;
+    }
+    /**
+     * Write the edges and unlabeled vertices of bulk draw calls with PGF basic-layer path
+     * commands instead of \\draw and \\node, which TeX processes several times faster. Each call
+     * sets its style once in a pgfscope and strokes or fills its paths in batches. Styles the
+     * basic layer cannot reproduce exactly, labeled vertices, and named coordinates keep TikZ.
+     */
+    void enableFastPgf() {
+        m_fastPgf = true;
+    }
+    void disableFastPgf() {
+        m_fastPgf = false;
+    }
+    /**
+     * Draw only what lies in viewport, a rectangle in the coordinates of the point set, such as
+     * the region of a zoomed inset whose printer is scaled to it. Edges are clipped to the
+     * viewport exactly and vertices outside it are left out, so TeX never processes them. Bulk
+     * draws given a SpatialGrid only look at the points or edges it finds in the viewport, so
+     * an index built once serves every inset of the same graph.
+     */
+    void enableViewport(const BoundingBox& viewport) {
+        m_viewport = viewport;
+    }
+    void disableViewport() {
+        m_viewport = BoundingBox();
+    }
+    /**
+     * Write each distinct point once, as a \\coordinate or as the vertex node drawn there, and
+     * have later edges refer to it by name, so a vertex shared by several edges is formatted
+     * once. Edges only reuse vertex nodes drawn before them. Each name costs TeX a few control
+     * sequences, so very large figures may need a larger hash_extra.
+     */
+    void enableNamedCoordinates() {
+        m_namedCoordinates = true;
+    }
+    void disableNamedCoordinates() {
+        m_namedCoordinates = false;
+        m_coordinateNames.clear();
+    }
+    /**
+     * Rasterize edges and vertices in-process into a PNG at dpi instead of emitting them as TikZ
+     * primitives, so dense figures cost no TeX memory. The image covers the autoscaled point set,
+     * is placed in the picture with \\includegraphics and is written next to the .tex on save.
+     * With labelOverlay, labeled vertices are still emitted as nodes on top of the image,
+     * otherwise their labels are dropped. Call before drawing.
+     */
+    void enableRaster(double dpi = 300, bool labelOverlay = true) {
+        if( !m_tiles.empty() )
+            throw std::logic_error("enableRaster: " + getTexFilename() + " is drawn in tiles");
+        const double margin = vertexRadius + 0.1; // cm, room for vertices and line caps on the boundary
+        m_rasterPixelsPerCm = dpi / 2.54;
+        m_rasterOrigin = Point{ _bounds.minX*getScaleX() - margin, _bounds.minY*getScaleY() - margin };
+        double widthCm = _bounds.width()*getScaleX() + 2*margin,
+               heightCm = _bounds.height()*getScaleY() + 2*margin;
+        m_raster = std::make_shared<RasterCanvas>( static_cast<size_t>(std::ceil(widthCm*m_rasterPixelsPerCm)),
+                                                   static_cast<size_t>(std::ceil(heightCm*m_rasterPixelsPerCm)) );
+        m_rasterOverlay = labelOverlay;
+
+        std::string& out = m_body.content;
+        out += "\\node [anchor=south west,inner sep=0pt] at ";
+        appendCoordinate( out, m_rasterOrigin.x, m_rasterOrigin.y );
+        out += " {"
+             + getGraphic( m_directory + getRasterFilename(),
+                           "width=" + formatNumber(m_raster->width() / m_rasterPixelsPerCm, m_numberFormat) + "cm,"
+                           + "height=" + formatNumber(m_raster->height() / m_rasterPixelsPerCm, m_numberFormat) + "cm" )
+             + "};\n";
+        flushBody();
+    }
+    std::string getRasterFilename() const {
+        return m_filename + "_raster.png";
+    }
+    /**
+     * Split the picture into columns by rows tiles covering the autoscaled point set, and draw
+     * each tile in a standalone document of its own. The tiles are compiled before this
+     * document, concurrently like other precompiled subdocuments, and placed back at their
+     * offsets with \includegraphics, so each TeX run holds only a share of the primitives.
+     * Edges are clipped at the tile boundaries with some overlap, and vertices near a boundary
+     * are drawn in every tile they reach, so the pieces join seamlessly; only dash patterns
+     * restart at a boundary. The other drawing modes apply within each tile. Call before drawing.
+     */
+    void enableTiles(size_t columns, size_t rows) {
+        assert(columns > 0 && rows > 0);
+        if( m_raster || !m_tiles.empty() )
+            throw std::logic_error("enableTiles: " + getTexFilename() + " is already rasterized or tiled");
+        const double margin = vertexRadius + 0.1; // cm, room for vertices and line caps on the boundary
+        m_tileOrigin = Point{ _bounds.minX*getScaleX() - margin, _bounds.minY*getScaleY() - margin };
+        m_tileWidth = (_bounds.width()*getScaleX() + 2*margin) / columns;
+        m_tileHeight = (_bounds.height()*getScaleY() + 2*margin) / rows;
+        m_tileOverlap = margin;
+        m_tileColumns = columns;
+        m_tileRows = rows;
+
+        std::string& out = m_body.content;
+        for( size_t row=0; row<rows; ++row ) {
+            for( size_t column=0; column<columns; ++column ) {
+                double minX = m_tileOrigin.x + column*m_tileWidth, minY = m_tileOrigin.y + row*m_tileHeight;
+                auto tile = std::make_shared<GraphPrinter>( m_directory + getTileFilename(column, row), BoundingBox() );
+                tile->m_documentClassOptions = "border=0pt";
+                // fix the extent of the tile, and cut off what reaches into its neighbors
+                std::string rectangle;
+                appendCoordinate( rectangle, minX, minY );
+                rectangle += " rectangle ";
+                appendCoordinate( rectangle, minX + m_tileWidth, minY + m_tileHeight );
+                tile->m_body.content = "\\useasboundingbox " + rectangle + ";\n\\clip " + rectangle + ";\n\n";
+                m_tiles.push_back( tile );
+
+                out += "\\node [anchor=south west,inner sep=0pt] at ";
+                appendCoordinate( out, minX, minY );
+                out += " {"
+                     + getGraphic( m_directory + getTileFilename(column, row) + ".pdf",
+                                   "width=" + formatNumber(m_tileWidth, m_numberFormat) + "cm,"
+                                   + "height=" + formatNumber(m_tileHeight, m_numberFormat) + "cm" )
+                     + "};\n";
+            }
+        }
+        flushBody();
+    }
+    std::string getTileFilename(size_t column, size_t row) const {
+        return m_filename + "_tile" + std::to_string(column) + "_" + std::to_string(row);
+    }
+protected:
+    /** A line with end points that are already scaled to the output. */
+    struct Segment {
+        double x1, y1, x2, y2;
+    };
+    void saveSidecarFiles() const override {
+        if( m_raster )
+            m_raster->savePng( m_directory + getRasterFilename() );
+        for( const auto& tile : m_tiles ) {
+            tile->m_colors = m_colors;
+            tile->m_compiler = m_compiler;
+            tile->m_usePrecompiledPreamble = m_usePrecompiledPreamble;
+            tile->m_useCompileCache = m_useCompileCache;
+            tile->m_compileTimeout = m_compileTimeout;
+            tile->m_retryOnCapacity = m_retryOnCapacity;
+            tile->m_fallbackCompiler = m_fallbackCompiler;
+            tile->m_capacityEnvironment = m_capacityEnvironment;
+            tile->m_verbose = m_verbose;
+            tile->save();
+        }
+    }
+    std::vector<std::string> getSidecarFiles() const override {
+        std::vector<std::string> files;
+        if( m_raster )
+            files.push_back( m_directory + getRasterFilename() );
+        for( const auto& tile : m_tiles )
+            files.push_back( tile->m_directory + tile->getPdfFilename() );
+        return files;
+    }
+    void addPrimitiveCounts( PrinterMetrics& metrics ) const override {
+        metrics.primitives["edges"] += m_edgesDrawn;
+        metrics.primitives["vertices"] += m_verticesDrawn;
+        if( m_polylinesDrawn > 0 )
+            metrics.primitives["polylines"] += m_polylinesDrawn;
+    }
+    /** The tiles are compiled as subdocuments; they are saved with this document. */
+    std::vector<BuildScheduler::Job> getSubdocumentJobs() const override {
+        std::vector<BuildScheduler::Job> jobs = TikzPrinter::getSubdocumentJobs();
+        for( const auto& tile : m_tiles )
+            addCompileJob( jobs, *tile );
+        return jobs;
+    }
+    /** Draw a line between two points that are already scaled to the output. */
+    void emitLine( double x1, double y1, double x2, double y2, const OptionsList& options ) {
+        if( !m_viewport.empty() ) {
+            Segment l{ x1, y1, x2, y2 };
+            if( !clipToViewport( l ) )
+                return;
+            x1 = l.x1, y1 = l.y1, x2 = l.x2, y2 = l.y2;
+        }
+        if( !simplifyLine( x1, y1, x2, y2, options ) )
+            return;
+        ++m_edgesDrawn;
+        if( !m_tiles.empty() ) {
+            forEachTileOf( Segment{ x1, y1, x2, y2 }, [&]( size_t tile, const Segment& l ) {
+                getTile(tile).emitLine( l.x1, l.y1, l.x2, l.y2, options );
+            } );
+            return;
+        }
+        if( m_raster ) {
+            const RasterStyle& style = rasterStyle(options);
+            m_raster->drawLine( (x1 - m_rasterOrigin.x) * m_rasterPixelsPerCm, (y1 - m_rasterOrigin.y) * m_rasterPixelsPerCm,
+                                (x2 - m_rasterOrigin.x) * m_rasterPixelsPerCm, (y2 - m_rasterOrigin.y) * m_rasterPixelsPerCm,
+                                style.lineWidthInPt / 72.27 * 2.54 * m_rasterPixelsPerCm, style.stroke );
+            return;
+        }
+        std::string& out = m_body.content;
+        if( m_namedCoordinates ) {
+            const std::string& a = getCoordinateName( x1, y1 );
+            const std::string& b = getCoordinateName( x2, y2 );
+            out += "\\draw ";
+            appendStyle( out, options );
+            out += '(';
+            out += a;
+            out += ") -- (";
+            out += b;
+            out += ");\n";
+            flushBody();
+            return;
+        }
+        out += "\\draw ";
+        appendStyle( out, options );
+        appendCoordinate( out, x1, y1 );
+        out += " -- ";
+        appendCoordinate( out, x2, y2 );
+        out += ";\n";
+        flushBody();
+    }
+    /** Draw a vertex at a point that is already scaled to the output. */
+    void emitVertex( double x, double y, const std::string& label, const OptionsList& options ) {
+        if( !isInViewport( x, y ) )
+            return;
+        if( !simplifyVertex( x, y, label, options ) )
+            return;
+        ++m_verticesDrawn;
+        if( !m_tiles.empty() ) {
+            forEachTileOf( Segment{ x, y, x, y }, [&]( size_t tile, const Segment& ) {
+                getTile(tile).emitVertex( x, y, label, options );
+            } );
+            return;
+        }
+        if( m_raster && ( label.empty() || !m_rasterOverlay ) ) {
+            m_raster->fillCircle( (x - m_rasterOrigin.x) * m_rasterPixelsPerCm, (y - m_rasterOrigin.y) * m_rasterPixelsPerCm,
+                                  vertexRadius / 2 * m_rasterPixelsPerCm, rasterStyle(options).fill );
+            return;
+        }
+        std::string& out = m_body.content;
+        if( m_namedCoordinates ) {
+            // a vertex at a named point is placed there by name, and is only named itself if labeled
+            auto named = m_coordinateNames.find( CoordinateKey{ x + 0.0, y + 0.0 } );
+            std::string name = !label.empty() ? "vertex" + label
+                             : named == m_coordinateNames.end() ? "v" + std::to_string(m_coordinateCount++) : "";
+            out += "\\node ";
+            if( !name.empty() ) {
+                out += '(';
+                out += name;
+                out += ") ";
+            }
+            appendStyle( out, options, "fill" );
+            out += "at ";
+            if( named != m_coordinateNames.end() ) {
+                out += '(';
+                out += named->second;
+                out += ')';
+            } else {
+                appendCoordinate( out, x, y );
+                m_coordinateNames.emplace( CoordinateKey{ x + 0.0, y + 0.0 }, name + ".center" );
+            }
+        } else {
+            out += "\\node (vertex";
+            out += label;
+            out += ") ";
+            appendStyle( out, options, "fill" );
+            out += "at ";
+            appendCoordinate( out, x, y );
+        }
+        out += " {";
+        out += label;
+        out += "};\n";
+        flushBody();
+    }
+    /**
+     * Emit n lines, where getLine(i, x1, y1, x2, y2) sets the scaled end points of line i and only
+     * reads shared state. Without level of detail, rasterization or named coordinates, whose state
+     * is updated per primitive, the lines are formatted by m_drawThreads threads into private buffers that are
+     * appended in order, so the output is the same as from emitLine.
+     */
+    template< typename GetLine >
+    void emitLines( size_t n, GetLine getLine, const OptionsList& options ) {
+        GenerationTimer timer( *this );
+        if( m_viewport.empty() ) {
+            emitVisibleLines( n, getLine, options );
+            return;
+        }
+        std::vector<Segment> visible;
+        for( size_t i=0; i<n; ++i ) {
+            Segment l;
+            getLine( i, l.x1, l.y1, l.x2, l.y2 );
+            if( clipToViewport( l ) )
+                visible.push_back( l );
+        }
+        emitVisibleLines( visible.size(), [&]( size_t i, double& x1, double& y1, double& x2, double& y2 ) {
+            x1 = visible[i].x1;
+            y1 = visible[i].y1;
+            x2 = visible[i].x2;
+            y2 = visible[i].y2;
+        }, options );
+    }
+    /** Emit n lines that are inside the viewport. */
+    template< typename GetLine >
+    void emitVisibleLines( size_t n, GetLine getLine, const OptionsList& options ) {
+        if( !m_tiles.empty() ) {
+            emitTiledLines( n, getLine, options );
+            return;
+        }
+        if( m_polylineMaxSegments > 0 && !m_raster ) {
+            emitPolylines( n, getLine, options );
+            return;
+        }
+        std::string pgfStyle;
+        if( usePgf() && getPgfStrokeStyle( options, pgfStyle ) ) {
+            emitPgfLines( n, getLine, options, pgfStyle );
+            return;
+        }
+        if( !isShardable(n) ) {
+            for( size_t i=0; i<n; ++i ) {
+                double x1, y1, x2, y2;
+                getLine( i, x1, y1, x2, y2 );
+                emitLine( x1, y1, x2, y2, options );
+            }
+            return;
+        }
+        m_edgesDrawn += n;
+        std::string prefix = "\\draw ";
+        appendStyle( prefix, options );
+        emitSharded( n, [&]( std::string& out, size_t i ) {
+            double x1, y1, x2, y2;
+            getLine( i, x1, y1, x2, y2 );
+            out += prefix;
+            appendCoordinate( out, x1, y1 );
+            out += " -- ";
+            appendCoordinate( out, x2, y2 );
+            out += ";\n";
+        } );
+    }
+    /** Emit lines whose end points are already scaled. */
+    void emitSegments( const std::vector<Segment>& segments, const OptionsList& options ) {
+        emitLines( segments.size(), [&]( size_t i, double& x1, double& y1, double& x2, double& y2 ) {
+            x1 = segments[i].x1;
+            y1 = segments[i].y1;
+            x2 = segments[i].x2;
+            y2 = segments[i].y2;
+        }, options );
+    }
+    /** Emit vertices at points that are already scaled, labeled if labels is not empty. */
+    void emitPoints( const std::vector<Point>& points, const std::vector<std::string>& labels, const OptionsList& options ) {
+        emitVertices( points.size(), [&]( size_t i, double& x, double& y, std::string& label ) {
+            x = points[i].x;
+            y = points[i].y;
+            if( !labels.empty() )
+                label = labels[i];
+        }, options, !labels.empty() );
+    }
+    /**
+     * Emit n lines as polylines: number the distinct end points, drop repeated edges, and walk
+     * the remaining edges greedily, starting from end points of odd degree, where every
+     * covering set of paths has to start or end. Lines from a point to itself draw nothing and
+     * are skipped.
+     */
+    template< typename GetLine >
+    void emitPolylines( size_t n, GetLine getLine, const OptionsList& options ) {
+        std::vector<Point> points;
+        std::unordered_map<CoordinateKey,uint32_t,CoordinateKeyHash> pointIds;
+        auto pointId = [&]( double x, double y ) {
+            auto found = pointIds.emplace( CoordinateKey{ x + 0.0, y + 0.0 }, static_cast<uint32_t>(points.size()) );
+            if( found.second )
+                points.push_back( Point{ x, y } );
+            return found.first->second;
+        };
+        std::vector<std::pair<uint32_t,uint32_t>> edges;
+        std::unordered_set<uint64_t> seen;
+        for( size_t i=0; i<n; ++i ) {
+            double x1, y1, x2, y2;
+            getLine( i, x1, y1, x2, y2 );
+            if( !simplifyLine( x1, y1, x2, y2, options ) )
+                continue;
+            uint32_t a = pointId( x1, y1 ), b = pointId( x2, y2 );
+            if( a != b && seen.insert( uint64_t(std::min(a, b)) << 32 | std::max(a, b) ).second )
+                edges.emplace_back( a, b );
+        }
+
+        // incident edges of each point
+        std::vector<size_t> offsets( points.size() + 1, 0 );
+        for( const auto& e : edges ) {
+            ++offsets[e.first + 1];
+            ++offsets[e.second + 1];
+        }
+        for( size_t v=0; v<points.size(); ++v )
+            offsets[v+1] += offsets[v];
+        std::vector<uint32_t> incident( offsets.back() );
+        std::vector<size_t> next( offsets.begin(), offsets.end() - 1 );
+        for( uint32_t e=0; e<edges.size(); ++e ) {
+            incident[next[edges[e].first]++] = e;
+            incident[next[edges[e].second]++] = e;
+        }
+
+        // walk the edges into chains of point ids, stored one after the other
+        std::vector<uint32_t> chainPoints;
+        std::vector<size_t> chainStarts;
+        std::vector<bool> used( edges.size(), false );
+        std::vector<size_t> cursor( offsets.begin(), offsets.end() - 1 );
+        auto walkFrom = [&]( uint32_t v ) {
+            while( true ) {
+                while( cursor[v] < offsets[v+1] && used[incident[cursor[v]]] )
+                    ++cursor[v];
+                if( cursor[v] == offsets[v+1] )
+                    return;
+                chainStarts.push_back( chainPoints.size() );
+                chainPoints.push_back( v );
+                for( size_t segments=0; segments<m_polylineMaxSegments; ++segments ) {
+                    while( cursor[v] < offsets[v+1] && used[incident[cursor[v]]] )
+                        ++cursor[v];
+                    if( cursor[v] == offsets[v+1] )
+                        break;
+                    uint32_t e = incident[cursor[v]];
+                    used[e] = true;
+                    v = edges[e].first == v ? edges[e].second : edges[e].first;
+                    chainPoints.push_back( v );
+                }
+            }
+        };
+        for( uint32_t v=0; v<points.size(); ++v )
+            if( (offsets[v+1] - offsets[v]) % 2 == 1 )
+                walkFrom( v );
+        for( uint32_t v=0; v<points.size(); ++v )
+            walkFrom( v );
+        chainStarts.push_back( chainPoints.size() );
+
+        OptionsList chainOptions = options;
+        chainOptions.emplace_back( "line join", "round" );
+        std::string prefix = "\\draw ";
+        appendStyle( prefix, chainOptions );
+        auto appendChain = [&]( std::string& out, size_t chain, bool named ) {
+            size_t first = chainStarts[chain], last = chainStarts[chain+1] - 1;
+            bool closed = last - first > 2 && chainPoints[first] == chainPoints[last];
+            out += prefix;
+            for( size_t i=first; i<=last; ++i ) {
+                if( i > first )
+                    out += " -- ";
+                if( closed && i == last ) {
+                    out += "cycle"; // joins the last edge to the first
+                    break;
+                }
+                const Point& p = points[chainPoints[i]];
+                if( named ) {
+                    out += '(';
+                    out += getCoordinateName( p.x, p.y );
+                    out += ')';
+                } else {
+                    appendCoordinate( out, p.x, p.y );
+                }
+            }
+            out += ";\n";
+        };
+        size_t chains = chainStarts.size() - 1;
+        m_edgesDrawn += edges.size();
+        m_polylinesDrawn += chains;
+        std::string pgfStyle;
+        if( usePgf() && getPgfStrokeStyle( chainOptions, pgfStyle ) ) {
+            if( chains == 0 )
+                return;
+            beginPgfScope( pgfStyle );
+            emitSharded( chains, [&]( std::string& out, size_t chain ) {
+                size_t first = chainStarts[chain], last = chainStarts[chain+1] - 1;
+                bool closed = last - first > 2 && chainPoints[first] == chainPoints[last];
+                for( size_t i=first; i<=last; ++i ) {
+                    if( closed && i == last ) {
+                        out += "\\pgfpathclose";
+                        break;
+                    }
+                    const Point& p = points[chainPoints[i]];
+                    appendPgfPoint( out, i == first ? "\\cpptexM" : "\\cpptexL", p.x, p.y );
+                }
+                out += "\\pgfusepath{stroke}\n";
+            } );
+            endPgfScope();
+        } else if( m_namedCoordinates ) {
+            std::string line; // built aside, as naming a point writes its definition to the body
+            for( size_t chain=0; chain<chains; ++chain ) {
+                line.clear();
+                appendChain( line, chain, true );
+                m_body.content += line;
+                flushBody();
+            }
+        } else {
+            emitSharded( chains, [&]( std::string& out, size_t chain ) { appendChain( out, chain, false ); } );
+        }
+    }
+    /**
+     * Emit n vertices like emitLines, where getVertex(i, x, y, label) sets vertex i and labeled
+     * tells whether any vertex has a label.
+     */
+    template< typename GetVertex >
+    void emitVertices( size_t n, GetVertex getVertex, const OptionsList& options, bool labeled ) {
+        GenerationTimer timer( *this );
+        if( m_viewport.empty() ) {
+            emitVisibleVertices( n, getVertex, options, labeled );
+            return;
+        }
+        std::vector<Point> visible;
+        std::vector<std::string> labels;
+        std::string label;
+        for( size_t i=0; i<n; ++i ) {
+            Point p;
+            getVertex( i, p.x, p.y, label );
+            if( !isInViewport( p.x, p.y ) )
+                continue;
+            visible.push_back( p );
+            if( labeled )
+                labels.push_back( label );
+        }
+        emitVisibleVertices( visible.size(), [&]( size_t i, double& x, double& y, std::string& vertexLabel ) {
+            x = visible[i].x;
+            y = visible[i].y;
+            if( labeled )
+                vertexLabel = labels[i];
+        }, options, labeled );
+    }
+    /** Emit n vertices that are inside the viewport. */
+    template< typename GetVertex >
+    void emitVisibleVertices( size_t n, GetVertex getVertex, const OptionsList& options, bool labeled ) {
+        if( !m_tiles.empty() ) {
+            emitTiledVertices( n, getVertex, options, labeled );
+            return;
+        }
+        std::string pgfStyle;
+        if( !labeled && usePgf() && getPgfVertexStyle( options, pgfStyle ) ) {
+            emitPgfVertices( n, getVertex, options, pgfStyle );
+            return;
+        }
+        if( !isShardable(n) ) {
+            double x, y;
+            std::string label;
+            for( size_t i=0; i<n; ++i ) {
+                getVertex( i, x, y, label );
+                emitVertex( x, y, label, options );
+            }
+            return;
+        }
+        m_verticesDrawn += n;
+        std::string style;
+        appendStyle( style, options, "fill" );
+        emitSharded( n, [&]( std::string& out, size_t i ) {
+            double x, y;
+            std::string label;
+            getVertex( i, x, y, label );
+            out += "\\node (vertex";
+            out += label;
+            out += ") ";
+            out += style;
+            out += "at ";
+            appendCoordinate( out, x, y );
+            out += " {";
+            out += label;
+            out += "};\n";
+        } );
+    }
 private:
+    static constexpr size_t ShardSize = 1 << 16; // fewest primitives worth a thread of their own
+
+    template< typename Iterator >
+    static constexpr bool isRandomAccess() {
+        return std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<Iterator>::iterator_category>::value;
+    }
+    /** Convert and scale coordinates in a single loop the compiler can vectorize, split over m_drawThreads. */
+    template< typename Coordinate >
+    void scaleCoordinates( const Coordinate* in, size_t n, double scale, std::vector<double>& out ) const {
+        static_assert( std::is_arithmetic<Coordinate>::value, "coordinates must be arithmetic" );
+        out.resize(n);
+        double* scaled = out.data();
+        parallelFor( n, [=]( size_t begin, size_t end, size_t ) {
+            for( size_t i=begin; i<end; ++i )
+                scaled[i] = static_cast<double>(in[i]) * scale;
+        }, m_drawThreads, ShardSize );
+    }
+    bool isShardable( size_t n ) const {
+        return m_lodResolution == 0 && !m_raster && !m_namedCoordinates && n > ShardSize && parallelChunkCount(n, m_drawThreads, ShardSize) > 1;
+    }
+    /**
+     * Call format(out, i) for i in [0,n) on several threads, each formatting one contiguous shard
+     * into its own buffer, and append the buffers to the body in order, flushing after each.
+     */
+    template< typename Format >
+    void emitSharded( size_t n, Format format ) {
+        std::vector<std::string> buffers(parallelChunkCount(n, m_drawThreads, ShardSize));
+        parallelFor( n, [&]( size_t begin, size_t end, size_t shard ) {
+            std::string& out = buffers[shard];
+            for( size_t i=begin; i<end; ++i )
+                format( out, i );
+        }, m_drawThreads, ShardSize );
+        for( auto& buffer : buffers ) {
+            m_body.content += buffer;
+            std::string().swap( buffer );
+            flushBody();
+        }
+    }
+
+    /**
+     * Apply level of detail to a line: snap its end points to the grid, or return false if it
+     * is dropped.
+     */
+    bool simplifyLine( double& x1, double& y1, double& x2, double& y2, const OptionsList& options ) {
+        if( m_lodResolution == 0 )
+            return true;
+        auto a = snapToGrid(x1, y1), b = snapToGrid(x2, y2);
+        if( a == b ) {
+            ++m_lodStats.zeroLengthEdges;
+            return false;
+        }
+        if( b < a )
+            std::swap(a, b);
+        GridKey key{ a.first, a.second, b.first, b.second, styleKey(options) };
+        if( !m_lodEdges.insert(key) ) {
+            ++m_lodStats.duplicateEdges;
+            return false;
+        }
+        x1 = a.first * m_lodResolution;
+        y1 = a.second * m_lodResolution;
+        x2 = b.first * m_lodResolution;
+        y2 = b.second * m_lodResolution;
+        return true;
+    }
+
+    /**
+     * Apply level of detail to a vertex: snap it to the grid, or return false if it is dropped.
+     */
+    bool simplifyVertex( double& x, double& y, const std::string& label, const OptionsList& options ) {
+        if( m_lodResolution == 0 )
+            return true;
+        auto p = snapToGrid(x, y);
+        if( label.empty() && !m_lodVertices.insert(GridKey{ p.first, p.second, 0, 0, styleKey(options) }) ) {
+            ++m_lodStats.collapsedVertices;
+            return false;
+        }
+        x = p.first * m_lodResolution;
+        y = p.second * m_lodResolution;
+        return true;
+    }
+
+    static constexpr size_t PgfBatchSize = 64; // paths per \\pgfusepath
+
+    bool usePgf() const {
+        return m_fastPgf && !m_raster && !m_namedCoordinates;
+    }
+    /**
+     * The PGF commands for a TikZ style of lines. Returns false if the style has an option
+     * they do not reproduce.
+     */
+    static bool getPgfStrokeStyle( const OptionsList& options, std::string& commands ) {
+        static const std::map<std::string,std::string> patterns = {
+            {"solid",          "\\pgfsetdash{}{0pt}"},
+            {"dashed",         "\\pgfsetdash{{3pt}{3pt}}{0pt}"},
+            {"densely dashed", "\\pgfsetdash{{3pt}{2pt}}{0pt}"},
+            {"loosely dashed", "\\pgfsetdash{{3pt}{6pt}}{0pt}"},
+            {"dotted",         "\\pgfsetdash{{\\pgflinewidth}{2pt}}{0pt}"},
+            {"densely dotted", "\\pgfsetdash{{\\pgflinewidth}{1pt}}{0pt}"},
+            {"loosely dotted", "\\pgfsetdash{{\\pgflinewidth}{4pt}}{0pt}"},
+        };
+        static const std::map<std::string,std::string> joins = {
+            {"round", "\\pgfsetroundjoin"}, {"bevel", "\\pgfsetbeveljoin"}, {"miter", "\\pgfsetmiterjoin"},
+        };
+        commands.clear();
+        for( const auto& o : options ) {
+            auto pattern = patterns.find(o.first);
+            if( pattern != patterns.end() && o.second.empty() ) {
+                commands += pattern->second;
+            } else if( o.first == "color" && !o.second.empty() ) {
+                commands += "\\pgfsetcolor{" + o.second + "}";
+            } else if( o.first == "draw" && !o.second.empty() ) {
+                commands += "\\pgfsetstrokecolor{" + o.second + "}";
+            } else if( o.first == "line width" && !o.second.empty() ) {
+                commands += "\\pgfsetlinewidth{" + getPgfLength(o.second) + "}";
+            } else if( o.first == "line join" && joins.count(o.second) ) {
+                commands += joins.at(o.second);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+    /**
+     * The PGF commands filling a vertex node of a TikZ style, which must use the vertex style
+     * and may only change its color. Returns false otherwise.
+     */
+    bool getPgfVertexStyle( const OptionsList& options, std::string& commands ) const {
+        std::string color, fill;
+        bool vertex = false;
+        for( const auto& o : options ) {
+            if( o.first == "vertex" )
+                vertex = true;
+            else if( o.first == "color" )
+                color = o.second;
+            else if( o.first == "fill" )
+                fill = o.second;
+            else if( o.first != "circle" && o.first != "line width" ) // the border is not drawn
+                return false;
+        }
+        if( !vertex )
+            return false;
+        // the vertex style is a circle of diameter vertexRadius, filled with the fill or text color
+        fill = !fill.empty() ? fill : color;
+        commands = (fill.empty() ? "" : "\\pgfsetfillcolor{" + fill + "}")
+                 + "\\def\\cpptexradius{" + formatNumber(vertexRadius / 2, {6}) + "cm}";
+        return true;
+    }
+    /** A TikZ length for PGF, where a plain number means points. */
+    static std::string getPgfLength( const std::string& length ) {
+        return !length.empty() && (std::isdigit(static_cast<unsigned char>(length.back())) || length.back() == '.')
+             ? length + "pt" : length;
+    }
+    void appendPgfPoint( std::string& out, const char* macro, double x, double y ) const {
+        out += macro;
+        out += '{';
+        appendNumber( out, x, m_numberFormat );
+        out += "}{";
+        appendNumber( out, y, m_numberFormat );
+        out += '}';
+    }
+    /** Open a pgfscope with a style, defining the path macros the first time. */
+    void beginPgfScope( const std::string& style ) {
+        if( !m_pgfMacrosDefined ) {
+            m_pgfMacrosDefined = true;
+            std::string macros = "\\def\\cpptexM#1#2{\\pgfpathmoveto{\\pgfqpoint{#1cm}{#2cm}}}\n"
+                                 "\\def\\cpptexL#1#2{\\pgfpathlineto{\\pgfqpoint{#1cm}{#2cm}}}\n"
+                                 "\\def\\cpptexE#1#2#3#4{\\cpptexM{#1}{#2}\\cpptexL{#3}{#4}}\n"
+                                 "\\def\\cpptexV#1#2{\\pgfpathcircle{\\pgfqpoint{#1cm}{#2cm}}{\\cpptexradius}}\n";
+            if( m_stream ) {
+                addRawText( macros );
+            } else {
+                m_body.header += macros;
+            }
+        }
+        m_body.content += "\\begin{pgfscope}";
+        m_body.content += style;
+        m_body.content += '\n';
+    }
+    void endPgfScope() {
+        m_body.content += "\\end{pgfscope}\n";
+        flushBody();
+    }
+    /** Stroke n lines as PGF paths, in batches of PgfBatchSize. */
+    template< typename GetLine >
+    void emitPgfLines( size_t n, GetLine getLine, const OptionsList& options, const std::string& style ) {
+        if( m_lodResolution > 0 ) {
+            std::vector<Segment> kept;
+            for( size_t i=0; i<n; ++i ) {
+                Segment l;
+                getLine( i, l.x1, l.y1, l.x2, l.y2 );
+                if( simplifyLine( l.x1, l.y1, l.x2, l.y2, options ) )
+                    kept.push_back( l );
+            }
+            m_edgesDrawn += kept.size();
+            emitPgfPaths( kept.size(), [&]( std::string& out, size_t i ) {
+                appendPgfPoint( out, "\\cpptexE", kept[i].x1, kept[i].y1 );
+                appendPgfPoint( out, "", kept[i].x2, kept[i].y2 );
+            }, "stroke", style );
+            return;
+        }
+        m_edgesDrawn += n;
+        emitPgfPaths( n, [&]( std::string& out, size_t i ) {
+            Segment l;
+            getLine( i, l.x1, l.y1, l.x2, l.y2 );
+            appendPgfPoint( out, "\\cpptexE", l.x1, l.y1 );
+            appendPgfPoint( out, "", l.x2, l.y2 );
+        }, "stroke", style );
+    }
+    /** Fill n unlabeled vertices as PGF circles, in batches of PgfBatchSize. */
+    template< typename GetVertex >
+    void emitPgfVertices( size_t n, GetVertex getVertex, const OptionsList& options, const std::string& style ) {
+        if( m_lodResolution > 0 ) {
+            std::string label;
+            std::vector<Point> kept;
+            for( size_t i=0; i<n; ++i ) {
+                Point p;
+                getVertex( i, p.x, p.y, label );
+                if( simplifyVertex( p.x, p.y, label, options ) )
+                    kept.push_back( p );
+            }
+            m_verticesDrawn += kept.size();
+            emitPgfPaths( kept.size(), [&]( std::string& out, size_t i ) {
+                appendPgfPoint( out, "\\cpptexV", kept[i].x, kept[i].y );
+            }, "fill", style );
+            return;
+        }
+        m_verticesDrawn += n;
+        emitPgfPaths( n, [&]( std::string& out, size_t i ) {
+            Point p;
+            std::string label;
+            getVertex( i, p.x, p.y, label );
+            appendPgfPoint( out, "\\cpptexV", p.x, p.y );
+        }, "fill", style );
+    }
+    /** Emit n paths in a pgfscope, using them after every PgfBatchSize paths and after the last. */
+    template< typename AppendPath >
+    void emitPgfPaths( size_t n, AppendPath appendPath, const char* use, const std::string& style ) {
+        if( n == 0 )
+            return;
+        beginPgfScope( style );
+        std::string usePath = std::string("\\pgfusepath{") + use + "}\n";
+        emitSharded( n, [&]( std::string& out, size_t i ) {
+            appendPath( out, i );
+            if( i % PgfBatchSize == PgfBatchSize - 1 || i == n - 1 )
+                out += usePath;
+            else
+                out += '\n';
+        } );
+        endPgfScope();
+    }
+
+    /** Draw the points pointIndex finds in the viewport, or all points without a viewport. */
+    template< typename RandomAccessIterator >
+    void drawIndexedVertices( RandomAccessIterator pointsStart, RandomAccessIterator pointsEnd, const SpatialGrid& pointIndex,
+                              const OptionsList& options, bool labeled ) {
+        size_t n = pointsEnd - pointsStart;
+        assert( pointIndex.size() == n );
+        GenerationTimer timer( *this );
+        std::vector<size_t> visible;
+        if( !m_viewport.empty() )
+            visible = pointIndex.query( m_viewport );
+        emitVertices( m_viewport.empty() ? n : visible.size(), [&]( size_t i, double& x, double& y, std::string& label ) {
+            size_t id = m_viewport.empty() ? i : visible[i];
+            x = pointsStart[id].x() * getScaleX();
+            y = pointsStart[id].y() * getScaleY();
+            if( labeled ) {
+                label.clear();
+                appendNumber( label, id );
+            }
+        }, options, labeled );
+        m_body.content += "\n";
+    }
+    /** Clip a line that is scaled to the output to the viewport. Returns false if it is outside. */
+    bool clipToViewport( Segment& l ) const {
+        return clipSegment( l, m_viewport.minX*getScaleX(), m_viewport.minY*getScaleY(), m_viewport.maxX*getScaleX(), m_viewport.maxY*getScaleY() );
+    }
+    bool isInViewport( double x, double y ) const {
+        return m_viewport.empty() || ( x >= m_viewport.minX*getScaleX() && x <= m_viewport.maxX*getScaleX()
+                                    && y >= m_viewport.minY*getScaleY() && y <= m_viewport.maxY*getScaleY() );
+    }
+    /**
+     * Call f(tile, piece) for every tile that a line, or a vertex given as a line of length
+     * zero, reaches with the overlap, where piece is the part of it within the tile and overlap.
+     */
+    template< typename Function >
+    void forEachTileOf( const Segment& l, Function f ) const {
+        auto range = [this]( double min, double max, double origin, double size, size_t count ) {
+            double first = std::floor((min - m_tileOverlap - origin) / size),
+                   last = std::floor((max + m_tileOverlap - origin) / size);
+            return std::make_pair( static_cast<size_t>(std::max(0.0, first)),
+                                   static_cast<size_t>(std::max(0.0, std::min(count - 1.0, last))) );
+        };
+        auto columns = range( std::min(l.x1, l.x2), std::max(l.x1, l.x2), m_tileOrigin.x, m_tileWidth, m_tileColumns ),
+             rows = range( std::min(l.y1, l.y2), std::max(l.y1, l.y2), m_tileOrigin.y, m_tileHeight, m_tileRows );
+        for( size_t row=rows.first; row<=rows.second; ++row ) {
+            for( size_t column=columns.first; column<=columns.second; ++column ) {
+                Segment piece = l;
+                double minX = m_tileOrigin.x + column*m_tileWidth, minY = m_tileOrigin.y + row*m_tileHeight;
+                if( clipSegment( piece, minX - m_tileOverlap, minY - m_tileOverlap,
+                                 minX + m_tileWidth + m_tileOverlap, minY + m_tileHeight + m_tileOverlap ) )
+                    f( row*m_tileColumns + column, piece );
+            }
+        }
+    }
+    /**
+     * Clip a line to a rectangle with the Liang-Barsky algorithm. Returns false if no part of
+     * it is inside.
+     */
+    static bool clipSegment( Segment& l, double minX, double minY, double maxX, double maxY ) {
+        double dx = l.x2 - l.x1, dy = l.y2 - l.y1, t0 = 0, t1 = 1;
+        // the line enters or leaves the rectangle where p*t = q at each of its four sides
+        const double p[4] = { -dx, dx, -dy, dy },
+                     q[4] = { l.x1 - minX, maxX - l.x1, l.y1 - minY, maxY - l.y1 };
+        for( int side=0; side<4; ++side ) {
+            if( p[side] == 0 ) {
+                if( q[side] < 0 )
+                    return false; // parallel to the side and outside
+            } else {
+                double t = q[side] / p[side];
+                if( p[side] < 0 )
+                    t0 = std::max(t0, t);
+                else
+                    t1 = std::min(t1, t);
+            }
+        }
+        if( t0 > t1 )
+            return false;
+        Segment clipped = l;
+        if( t0 > 0 ) {
+            clipped.x1 = l.x1 + t0*dx;
+            clipped.y1 = l.y1 + t0*dy;
+        }
+        if( t1 < 1 ) {
+            clipped.x2 = l.x1 + t1*dx;
+            clipped.y2 = l.y1 + t1*dy;
+        }
+        l = clipped;
+        return true;
+    }
+    /** A tile, set to the drawing modes of this printer. Level of detail is applied before tiling. */
+    GraphPrinter& getTile( size_t tile ) {
+        GraphPrinter& printer = *m_tiles[tile];
+        printer.m_numberFormat = m_numberFormat;
+        printer.m_drawThreads = m_drawThreads;
+        printer.vertexRadius = vertexRadius;
+        printer.m_fastPgf = m_fastPgf;
+        printer.m_polylineMaxSegments = m_polylineMaxSegments;
+        printer.m_namedCoordinates = m_namedCoordinates;
+        return printer;
+    }
+    /** Clip n lines to the tiles and draw the pieces of each tile with one bulk call. */
+    template< typename GetLine >
+    void emitTiledLines( size_t n, GetLine getLine, const OptionsList& options ) {
+        std::vector<std::vector<Segment>> pieces( m_tiles.size() );
+        for( size_t i=0; i<n; ++i ) {
+            Segment l;
+            getLine( i, l.x1, l.y1, l.x2, l.y2 );
+            if( !simplifyLine( l.x1, l.y1, l.x2, l.y2, options ) )
+                continue;
+            ++m_edgesDrawn;
+            forEachTileOf( l, [&]( size_t tile, const Segment& piece ) { pieces[tile].push_back( piece ); } );
+        }
+        for( size_t tile=0; tile<m_tiles.size(); ++tile ) {
+            if( !pieces[tile].empty() )
+                getTile(tile).emitSegments( pieces[tile], options );
+        }
+    }
+    /** Sort n vertices into the tiles they reach and draw those of each tile with one bulk call. */
+    template< typename GetVertex >
+    void emitTiledVertices( size_t n, GetVertex getVertex, const OptionsList& options, bool labeled ) {
+        std::vector<std::vector<Point>> points( m_tiles.size() );
+        std::vector<std::vector<std::string>> labels( m_tiles.size() );
+        std::string label;
+        for( size_t i=0; i<n; ++i ) {
+            Point p;
+            getVertex( i, p.x, p.y, label );
+            if( !simplifyVertex( p.x, p.y, label, options ) )
+                continue;
+            ++m_verticesDrawn;
+            forEachTileOf( Segment{ p.x, p.y, p.x, p.y }, [&]( size_t tile, const Segment& ) {
+                points[tile].push_back( p );
+                if( labeled )
+                    labels[tile].push_back( label );
+            } );
+        }
+        for( size_t tile=0; tile<m_tiles.size(); ++tile ) {
+            if( !points[tile].empty() )
+                getTile(tile).emitPoints( points[tile], labels[tile], options );
+        }
+    }
+
+    struct GridKey {
+        int64_t x1, y1, x2, y2;
+        size_t style;
+
+        bool operator==(const GridKey& other) const {
+            return x1 == other.x1 && y1 == other.y1 && x2 == other.x2 && y2 == other.y2 && style == other.style;
+        }
+    };
+    struct GridKeyHash {
+        size_t operator()(const GridKey& key) const {
+            uint64_t h = key.style;
+            for( int64_t v : { key.x1, key.y1, key.x2, key.y2 } )
+                h = (h ^ static_cast<uint64_t>(v)) * 0x100000001b3ULL;
+            return static_cast<size_t>(h ^ (h >> 32));
+        }
+    };
+    /**
+     * The snapped primitives drawn last, in buckets of Ways slots picked by hash, so level of
+     * detail finds nearly all duplicates in bounded memory. A primitive landing in a full bucket
+     * replaces one of its entries.
+     */
+    class GridKeyCache {
+    public:
+        /** Forget every primitive and hold at most capacity, rounded up to a power of two, from now on. */
+        void reset( size_t capacity ) {
+            size_t slots = Ways;
+            while( slots < capacity )
+                slots <<= 1;
+            m_slots.assign( slots, Slot() );
+        }
+        /** Remember key; returns false if it was already remembered. */
+        bool insert( const GridKey& key ) {
+            size_t hash = GridKeyHash()(key);
+            Slot* bucket = &m_slots[hash & (m_slots.size() - Ways)];
+            for( size_t i=0; i<Ways; ++i ) {
+                if( !bucket[i].used ) {
+                    bucket[i].key = key;
+                    bucket[i].used = true;
+                    return true;
+                }
+                if( bucket[i].key == key )
+                    return false;
+            }
+            bucket[(hash >> 20) % Ways].key = key;
+            return true;
+        }
+
+    private:
+        static constexpr size_t Ways = 4;
+        struct Slot {
+            GridKey key{};
+            bool used = false;
+        };
+        std::vector<Slot> m_slots = std::vector<Slot>(Ways);
+    };
+    std::pair<int64_t,int64_t> snapToGrid( double x, double y ) const {
+        return { std::llround(x / m_lodResolution), std::llround(y / m_lodResolution) };
+    }
+    size_t styleKey( const OptionsList& options ) {
+        return options.empty() ? std::numeric_limits<size_t>::max() : internStyle(options);
+    }
+
+    struct CoordinateKey {
+        double x, y;
+
+        bool operator==(const CoordinateKey& other) const {
+            return x == other.x && y == other.y;
+        }
+    };
+    struct CoordinateKeyHash {
+        size_t operator()(const CoordinateKey& key) const {
+            return std::hash<double>()(key.x) * 0x100000001b3ULL ^ std::hash<double>()(key.y);
+        }
+    };
+    /** The name of the point (x,y), defining it as a \\coordinate first if it has none. */
+    const std::string& getCoordinateName( double x, double y ) {
+        auto found = m_coordinateNames.emplace( CoordinateKey{ x + 0.0, y + 0.0 }, std::string() ); // +0.0 turns -0 into 0
+        std::string& name = found.first->second;
+        if( found.second ) {
+            name = "v" + std::to_string(m_coordinateCount++);
+            std::string& out = m_body.content;
+            out += "\\coordinate (";
+            out += name;
+            out += ") at ";
+            appendCoordinate( out, x, y );
+            out += ";\n";
+        }
+        return name;
+    }
+
+    struct RasterStyle {
+        RasterCanvas::Color stroke = {0,0,0};
+        RasterCanvas::Color fill = {0,0,0};
+        double lineWidthInPt = 0.4; // TikZ default
+    };
+    /** The colors and line width of a style, parsed once per style. */
+    const RasterStyle& rasterStyle( const OptionsList& options ) {
+        if( options.empty() )
+            return m_rasterDefaultStyle;
+        size_t id = internStyle(options);
+        if( id >= m_rasterStyles.size() )
+            m_rasterStyles.resize( id+1 );
+        if( !m_rasterStyles[id].first ) {
+            RasterStyle& style = m_rasterStyles[id].second;
+            bool explicitFill = false;
+            for( const auto& o : options ) {
+                if( o.first == "color" ) {
+                    style.stroke = RasterCanvas::parseColor(o.second);
+                    if( !explicitFill )
+                        style.fill = style.stroke;
+                } else if( o.first == "draw" && !o.second.empty() && o.second != "none" ) {
+                    style.stroke = RasterCanvas::parseColor(o.second);
+                } else if( o.first == "fill" && !o.second.empty() && o.second != "none" ) {
+                    style.fill = RasterCanvas::parseColor(o.second);
+                    explicitFill = true;
+                } else if( o.first == "line width" ) {
+                    style.lineWidthInPt = std::atof(o.second.c_str()); // a trailing "pt" is ignored
+                }
+            }
+            m_rasterStyles[id].first = true;
+        }
+        return m_rasterStyles[id].second;
+    }
+
+    BoundingBox m_viewport; // in the coordinates of the point set; empty draws everything
+    std::vector<std::shared_ptr<GraphPrinter>> m_tiles; // by row, then column; empty unless tiled
+    size_t m_tileColumns = 0;
+    size_t m_tileRows = 0;
+    Point m_tileOrigin;
+    double m_tileWidth = 0;
+    double m_tileHeight = 0;
+    double m_tileOverlap = 0; // cm by which lines and vertices reach past a tile
+
+    std::shared_ptr<RasterCanvas> m_raster; // set when rasterizing
+    bool m_rasterOverlay = true;
+    double m_rasterPixelsPerCm = 0;
+    Point m_rasterOrigin;
+    RasterStyle m_rasterDefaultStyle;
+    std::vector<std::pair<bool,RasterStyle>> m_rasterStyles;
+
+    double m_lodResolution = 0; // disabled
+    LevelOfDetailStats m_lodStats;
+    GridKeyCache m_lodEdges;
+    GridKeyCache m_lodVertices;
+
+    size_t m_edgesDrawn = 0; // counted here rather than in m_metrics, as single draws are hot
+    size_t m_verticesDrawn = 0;
+    size_t m_polylinesDrawn = 0;
+
+    bool m_fastPgf = false;
+    bool m_pgfMacrosDefined = false;
+    size_t m_polylineMaxSegments = 0; // disabled
+    bool m_namedCoordinates = false;
+    size_t m_coordinateCount = 0;
+    std::unordered_map<CoordinateKey,std::string,CoordinateKeyHash> m_coordinateNames; // what edges write for a point
+
     double m_autoscaleVertexSizeFactor = 0.02;
 }; // class GraphPrinter
 
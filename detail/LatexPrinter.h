@@ -1,16 +1,23 @@
 #ifndef CPPTEX_LATEXPRINTER_H
 #define CPPTEX_LATEXPRINTER_H
 
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "BuildScheduler.h"
+#include "CompileReport.h"
+#include "PrinterMetrics.h"
 #include "util.h"
 
 namespace cpptex {
@@ -31,12 +38,16 @@ public:
     {
         std::tie(m_directory, m_filename) = splitDirectoriesFromFilename(path);
     }
+    virtual ~LatexPrinter() = default;
 
     // Document-level getters
     std::string getName() const {
         return m_filename;
     }
+    /** The text of the whole document; a streamed document is not kept in memory, so this throws for one. */
     std::string getFullDocumentText() const {
+        if(m_stream)
+            throw std::logic_error("getFullDocumentText: the text of streamed " + getTexFilename() + " is not kept in memory");
         return getDocumentHeader()
                + getBodyText()
                + getDocumentFooter();
@@ -45,18 +56,28 @@ public:
         return m_body.header + m_body.content + m_body.footer;
     }
     std::string getDocumentHeader() const {
-        std::string header = "\\documentclass{"
-                + m_documentType
-                + "}\n\n"
-                  + "\\usepackage[table]{xcolor}\n"
-                + "\\usepackage{tikz,pgfplots,amsmath,fullpage,rotating}\n"
-                + "\\usetikzlibrary{shapes}\n"
-                + "\\pgfplotsset{compat=1.15}\n\n"
+        std::string header = getPreamble()
+                + (m_usePrecompiledPreamble ? "\\csname endofdump\\endcsname\n" : "")
                 + getColorDefinitions()
                 + "\n\n\n\n"
                 + "\\begin{document}\n\n";
         return header;
     }
+    /** The fixed part of the document header, shared by every document of the same type and packages. */
+    std::string getPreamble() const {
+        std::string packages;
+        for(const auto& package : m_packages)
+            packages += "\\usepackage{" + package + "}\n";
+        return "\\documentclass"
+                + (m_documentClassOptions.empty() ? "" : "[" + m_documentClassOptions + "]")
+                + "{" + m_documentType
+                + "}\n\n"
+                  + "\\usepackage[table]{xcolor}\n"
+                + "\\usepackage{tikz,pgfplots,amsmath,fullpage,rotating}\n"
+                + packages
+                + "\\usetikzlibrary{shapes}\n"
+                + "\\pgfplotsset{compat=1.15}\n\n";
+    }
     static std::string getDocumentFooter() {
         return "\\end{document}";
     }
@@ -65,7 +86,7 @@ public:
         std::string header;
         if(subfigure) {
             header = std::string("\\begin{minipage}{")
-                    + std::to_string(ratioOfLineWidth) + "\\linewidth}";
+                    + formatNumber(ratioOfLineWidth) + "\\linewidth}";
         } else {
             header = std::string("\\begin{figure}[ht]");
             if(!options.empty()){
@@ -116,13 +137,23 @@ public:
     void addToDocument(const LatexPrinter& printer, const bool precompile = false) {
         std::string includeName = printer.getName();
         if(precompile) {
-            printer.compile();
+            if(m_parallelBuild) {
+                printer.save();
+                addCompileJob(m_subdocuments, printer);
+            } else {
+                printer.compile();
+            }
             includeName += ".pdf";
             addGraphic(includeName);
+            m_includedFiles.push_back(printer.m_directory + printer.getPdfFilename());
         } else {
             printer.saveBody();
             includeName += m_bodySuffix;
             addInput(includeName);
+            m_includedFiles.push_back(printer.m_directory + printer.getTexFilenameForBody());
+            for( const auto& file : printer.getSidecarFiles() )
+                m_includedFiles.push_back(file);
+            addSubdocumentJobs(m_subdocuments, printer); // built along with ours
         }
 
 
@@ -161,13 +192,19 @@ public:
     }
     void addInput(const std::string& name) {
         m_body.content += "\\input{" + name + "}\n\n";
+        flushBody();
     }
 
-    void addGraphic(const std::string& name) {
-        m_body.content += "\\includegraphics{" + name + "}\n\n";
+    void addGraphic(const std::string& name, const std::string& options = "") {
+        m_body.content += getGraphic(name, options) + "\n\n";
+        flushBody();
+    }
+    static std::string getGraphic(const std::string& name, const std::string& options = "") {
+        return "\\includegraphics" + (options.empty() ? "" : "[" + options + "]") + "{" + name + "}";
     }
     void addRawText(const std::string& text) {
         m_body.content += text;
+        flushBody();
     }
     void clearpage() {
         addRawText("\\clearpage\n\n");
@@ -180,43 +217,222 @@ public:
         }
     }
 
+    /**
+     * Open the .tex file up front and write the document header and body header to it. From then
+     * on, body content is flushed to the file whenever more than bufferSize bytes are buffered, so
+     * memory use stays constant however much is drawn. Colors must be defined before calling this,
+     * since their definitions are part of the document header.
+     */
+    void beginStream(size_t bufferSize = 1 << 20) {
+        if(m_stream)
+            throw std::logic_error("beginStream: " + getTexFilename() + " is already streamed");
+
+        std::string texFilename = m_directory + getTexFilename();
+        FILE *fileOut = fopen(texFilename.c_str(), "w");
+        if(fileOut == nullptr)
+            throw std::runtime_error("beginStream: cannot open " + texFilename);
+
+        m_stream.open(fileOut);
+        m_stream->bufferSize = bufferSize;
+
+        writeToStream(getDocumentHeader());
+        writeToStream(m_body.header);
+        flushBody(true);
+    }
+    /** Flush the remaining body content, write the footers and close the streamed .tex file. */
+    void endStream() {
+        if(!isStreaming())
+            throw std::logic_error("endStream: " + getTexFilename() + " is not being streamed");
+
+        flushBody(true);
+        writeToStream(m_body.footer);
+        writeToStream(getDocumentFooter());
+
+        fclose(m_stream->file);
+        m_stream->file = nullptr;
+    }
+    bool isStreaming() const {
+        return m_stream && m_stream->file != nullptr;
+    }
+
     void save() const {
+        ScopedTimer timer(m_metrics.saveSeconds);
+        if(m_stream) {
+            if(isStreaming())
+                throw std::logic_error("save: call endStream() before saving " + getTexFilename());
+            saveSidecarFiles();
+            return; // the streamed file is already complete on disk
+        }
         std::string texFilename = m_directory + getTexFilename();
-        std::cout<<"Saving file "<<texFilename<<"..."<<std::flush;
+        log("Saving file " + texFilename + "...");
 
         FILE *fileOut = fopen(texFilename.c_str(), "w");
 
-        fprintf(fileOut, "%s", getFullDocumentText().c_str());
+        std::string text = getFullDocumentText();
+        fprintf(fileOut, "%s", text.c_str());
+        m_metrics.bytesWritten += text.size();
 
         fclose(fileOut);
-        std::cout<<"done."<<std::endl;
+        saveSidecarFiles();
+        log("done.\n");
     }
     void saveBody() const {
+        ScopedTimer timer(m_metrics.saveSeconds);
+        if(m_stream)
+            throw std::logic_error("saveBody: the body of streamed " + getTexFilename() + " is not kept in memory");
         std::string texFilename = m_directory + getTexFilenameForBody();
-        std::cout<<"Saving file "<<texFilename<<"..."<<std::flush;
+        log("Saving file " + texFilename + "...");
 
         FILE *fileOut = fopen(texFilename.c_str(), "w");
 
-        fprintf(fileOut, "%s", getBodyText().c_str());
+        std::string text = getBodyText();
+        fprintf(fileOut, "%s", text.c_str());
+        m_metrics.bytesWritten += text.size();
 
         fclose(fileOut);
-        std::cout<<"done."<<std::endl;
+        saveSidecarFiles();
+        log("done.\n");
     }
+    /** Precision policy for numbers the printer writes into the document. */
+    NumberFormat m_numberFormat;
+
+    /** Options of the document class, such as border=2pt for standalone. */
+    std::string m_documentClassOptions;
+    /** Packages loaded after the usual ones, such as longtable; part of the precompiled preamble. */
+    std::set<std::string> m_packages;
     std::string m_compiler = "pdflatex";
-    void compile() const {
+    /**
+     * Save and compile the document, after the subdocuments it precompiles. Failures are printed
+     * to stderr even when m_verbose is off, with the errors found in the compiler log.
+     */
+    CompileReport compile() const {
         save();
+        buildSubdocuments();
+
+        if(m_usePrecompiledPreamble && !std::ifstream(getPreambleFormatPath() + ".fmt").good()) {
+            log("Building format " + getPreambleFormatPath() + "...");
+            ProcessResult format = runProcess(getPreambleFormatCommand(), "/dev/null", m_compileTimeout);
+            m_metrics.compileSeconds += format.seconds;
+            if(format.exitStatus != 0) {
+                CompileReport report = CompileReport::ofLog(getPreambleFormatPath() + ".log");
+                report.process = format;
+                reportFailure(getPreambleFormatPath() + ".fmt", report);
+            }
+            log("done.\n");
+        }
 
-        std::cout<<"Compiling "<< getTexFilename()<<"..."<<std::flush;
-        std::string command = m_compiler + " -output-directory=" + m_directory
-                        + " " + m_directory + getTexFilename() + " > /dev/null";
-        std::ignore = system(command.c_str());
-        std::cout<<"done."<<std::endl;
+        log("Compiling " + getTexFilename() + "...");
+        CompileInputs inputs = getCompileInputs();
+        CompileReport report;
+        report.upToDate = m_useCompileCache && inputs.isUpToDate();
+        if(report.upToDate) {
+            m_metrics.compiler = report;
+            log("up to date.\n");
+            return report;
+        }
+        report = runCompiler();
+        m_metrics.compiler = report;
+        m_metrics.compileSeconds += report.seconds;
+        ++m_metrics.compileRuns;
+        if(!report.succeeded()) {
+            log("failed.\n");
+            reportFailure(m_directory + getTexFilename(), report);
+            return report;
+        }
+        if(m_useCompileCache)
+            inputs.stamp();
+        log(report.attempts > 1 ? "done with " + report.engine + " after " + std::to_string(report.attempts) + " runs.\n" : "done.\n");
+        return report;
+    }
+    /** Kill a compiler run still going after this many seconds; 0 waits for ever. Also applies to subdocuments. */
+    double m_compileTimeout = 0;
+    /**
+     * When a run fails with "TeX capacity exceeded", run it again with the memory limits of
+     * m_capacityEnvironment, then, if that is not enough either, with m_fallbackCompiler, whose
+     * memory grows as needed. The fallback does not use the precompiled preamble, which was dumped
+     * by m_compiler. An empty m_fallbackCompiler skips the second retry.
+     */
+    bool m_retryOnCapacity = true;
+    std::string m_fallbackCompiler = "lualatex";
+    /** texmf.cnf settings read from the environment by the TeX Live engines, in words or entries. */
+    Environment m_capacityEnvironment = {
+        { "extra_mem_top", "10000000" },
+        { "extra_mem_bot", "10000000" },
+        { "save_size", "200000" },
+        { "stack_size", "20000" },
+        { "buf_size", "2000000" },
+        { "pool_size", "20000000" },
+        { "max_strings", "1000000" },
+        { "hash_extra", "1000000" },
+    };
+    /** The log the compiler writes next to the PDF. */
+    std::string getLogPath() const {
+        return m_directory + m_filename + ".log";
+    }
+    /**
+     * Skip the compiler when the PDF was produced from identical inputs: the document text, the
+     * compiler and the contents of every file the document includes. The key of the last
+     * successful run is kept in a .cpptex-cache file next to the PDF.
+     */
+    bool m_useCompileCache = false;
+    /**
+     * Compile against a format with the fixed preamble already loaded, so the compiler does not
+     * read tikz and pgfplots on every run. The format is dumped with mylatexformat, which skips the
+     * preamble up to the \\endofdump marker when the format is used. It is named after a hash of
+     * the preamble and the compiler, so it is built once and rebuilt only when the preamble changes.
+     */
+    bool m_usePrecompiledPreamble = false;
+    /** The compiler invocation for this document; m_compiler may carry extra arguments. */
+    std::vector<std::string> getCompileCommand() const {
+        return getCompileCommand("", m_usePrecompiledPreamble);
+    }
+    /** The invocation with engine, unless empty, in place of the first word of m_compiler, keeping its arguments. */
+    std::vector<std::string> getCompileCommand(const std::string& engine, bool withPrecompiledPreamble) const {
+        std::vector<std::string> command = getCompilerArguments();
+        if(command.empty())
+            throw std::runtime_error("getCompileCommand: no compiler set for " + getTexFilename());
+        if(!engine.empty())
+            command.front() = engine;
+        if(withPrecompiledPreamble)
+            command.push_back("-fmt=" + getPreambleFormatPath());
+        command.push_back("-interaction=nonstopmode");
+        command.push_back("-output-directory=" + m_directory);
+        command.push_back(m_directory + getTexFilename());
+        return command;
+    }
+    /**
+     * Compile subdocuments added with precompile concurrently, with at most maxWorkers compilers
+     * at a time (0 uses every core). Their compile jobs are collected, including those of nested
+     * subdocuments, and run together when this document is compiled, before the document itself.
+     */
+    void enableParallelBuild(unsigned maxWorkers = 0) {
+        m_parallelBuild = true;
+        m_buildWorkers = maxWorkers;
+    }
+    /** Print what save and compile are doing to stdout. Turn off to keep reports quiet. */
+    bool m_verbose = true;
+    /** The counters and timings of this printer so far. */
+    PrinterMetrics getMetrics() const {
+        PrinterMetrics metrics = m_metrics;
+        metrics.name = m_directory + getTexFilename();
+        addPrimitiveCounts(metrics);
+        return metrics;
+    }
+    /** Write getMetrics() as JSON to the file named by getMetricsFilename(), next to the .tex. */
+    void saveMetrics() const {
+        std::string filename = m_directory + getMetricsFilename();
+        std::ofstream out(filename);
+        if(!(out << getMetrics().toJson() << "\n"))
+            throw std::runtime_error("saveMetrics: failed writing " + filename);
+    }
+    std::string getMetricsFilename() const {
+        return m_filename + "_metrics.json";
     }
     std::string m_viewer = "evince";
     void display() const {
         compile();
 
-        std::cout<<"Opening "<<getPdfFilename()<<" for viewing."<<std::endl;
+        log("Opening " + getPdfFilename() + " for viewing.\n");
         std::string command = m_viewer + " " + m_directory + getPdfFilename() + " &";
         std::ignore = system(command.c_str());
         std::ignore = system(command.c_str());
@@ -234,11 +450,71 @@ protected:
         std::string footer;
     };
     Body m_body;
+
+    struct Stream {
+        FILE* file = nullptr;
+        size_t bufferSize = 0;
+        Fnv1aHash hash; // of everything written so far
+    };
+    /**
+     * The stream of a printer, owned by it alone. A printer whose stream is closed can be copied,
+     * along with the hash of what it wrote; copying one with an open stream throws, since both
+     * copies would write to the same file.
+     */
+    class StreamHandle {
+    public:
+        StreamHandle() = default;
+        StreamHandle(StreamHandle&& other) = default;
+        StreamHandle(const StreamHandle& other) {
+            *this = other;
+        }
+        StreamHandle& operator=(StreamHandle&& other) {
+            if(this != &other) {
+                close();
+                m_stream = std::move(other.m_stream);
+            }
+            return *this;
+        }
+        StreamHandle& operator=(const StreamHandle& other) {
+            if(this == &other)
+                return *this;
+            if(other.m_stream && other.m_stream->file != nullptr)
+                throw std::logic_error("a printer cannot be copied while its .tex file is streamed");
+            close();
+            m_stream.reset(other.m_stream ? new Stream(*other.m_stream) : nullptr);
+            return *this;
+        }
+        ~StreamHandle() {
+            close();
+        }
+
+        void open(FILE* file) {
+            close();
+            m_stream.reset(new Stream);
+            m_stream->file = file;
+        }
+        explicit operator bool() const {
+            return m_stream != nullptr;
+        }
+        Stream* operator->() const {
+            return m_stream.get();
+        }
+
+    private:
+        std::unique_ptr<Stream> m_stream;
+
+        void close() {
+            if(m_stream && m_stream->file != nullptr)
+                fclose(m_stream->file);
+        }
+    };
+    StreamHandle m_stream;
+
     std::string m_directory;
     std::string m_filename;
     std::string m_documentType;
     std::string m_caption;
-    std::unordered_set<std::string> m_colors;
+    std::set<std::string> m_colors; // ordered, so the document text is reproducible
     std::string m_bodySuffix = "_body";
 
     std::string getTexFilename() const {
@@ -250,6 +526,288 @@ protected:
     std::string getPdfFilename() const {
         return m_filename + ".pdf";
     }
+    std::vector<std::string> getCompilerArguments() const {
+        std::vector<std::string> arguments;
+        std::stringstream compiler(m_compiler);
+        std::string argument;
+        while(compiler >> argument)
+            arguments.push_back(argument);
+        return arguments;
+    }
+    /** The format file for this preamble, without the .fmt extension. */
+    std::string getPreambleFormatPath() const {
+        Fnv1aHash hash;
+        hash.update(getPreamble());
+        hash.update(m_compiler);
+        // kpathsea only takes a format name as a path when it is explicitly relative or absolute
+        std::string directory = m_directory.front() == '/' || m_directory.front() == '.' ? m_directory : "./" + m_directory;
+        return directory + "cpptex-" + hash.hex();
+    }
+    /** Dump the preamble of this document into the format named by getPreambleFormatPath(). */
+    std::vector<std::string> getPreambleFormatCommand() const {
+        std::vector<std::string> command = getCompilerArguments();
+        std::string engine = command.front().substr(command.front().rfind('/') + 1);
+        std::string format = getPreambleFormatPath();
+        command.push_back("-ini");
+        command.push_back("-interaction=nonstopmode");
+        command.push_back("-jobname=" + format.substr(format.rfind('/') + 1));
+        command.push_back("-output-directory=" + m_directory);
+        command.push_back("&" + engine);
+        command.push_back("mylatexformat.ltx");
+        command.push_back(m_directory + getTexFilename());
+        return command;
+    }
+
+    bool m_parallelBuild = false;
+    unsigned m_buildWorkers = 0;
+    std::vector<BuildScheduler::Job> m_subdocuments; // pending compile jobs of precompiled subdocuments
+
+    /**
+     * The compile jobs to run before this document is compiled, each after its dependencies.
+     * Printers that split their content into documents of their own add those here.
+     */
+    virtual std::vector<BuildScheduler::Job> getSubdocumentJobs() const {
+        return m_subdocuments;
+    }
+    /** Queue a job unless one building the same file is already queued, and return its index. */
+    static size_t addSubdocumentJob(std::vector<BuildScheduler::Job>& jobs, const BuildScheduler::Job& job) {
+        for(size_t i=0; i<jobs.size(); ++i) {
+            if(jobs[i].name == job.name)
+                return i;
+        }
+        jobs.push_back(job);
+        return jobs.size() - 1;
+    }
+    /** Queue the subdocument jobs of a printer and return their indices among jobs. */
+    static std::vector<size_t> addSubdocumentJobs(std::vector<BuildScheduler::Job>& jobs, const LatexPrinter& printer) {
+        std::vector<size_t> index; // of the printer's jobs among jobs
+        for(auto job : printer.getSubdocumentJobs()) {
+            for(auto& dependency : job.dependencies)
+                dependency = index[dependency];
+            index.push_back(addSubdocumentJob(jobs, job));
+        }
+        return index;
+    }
+    /** Queue the compilation of a saved document after the subdocuments it includes itself. */
+    static void addCompileJob(std::vector<BuildScheduler::Job>& jobs, const LatexPrinter& printer) {
+        std::vector<size_t> index = addSubdocumentJobs(jobs, printer);
+        BuildScheduler::Job job;
+        job.name = printer.m_directory + printer.getTexFilename();
+        job.command = printer.getCompileCommand();
+        job.timeoutSeconds = printer.m_compileTimeout;
+        job.retry = printer.getCapacityRetry();
+        if(printer.m_usePrecompiledPreamble) {
+            std::string formatFile = printer.getPreambleFormatPath() + ".fmt";
+            BuildScheduler::Job format;
+            format.name = formatFile;
+            format.command = printer.getPreambleFormatCommand();
+            format.isUpToDate = [formatFile]{ return std::ifstream(formatFile).good(); };
+            format.timeoutSeconds = printer.m_compileTimeout;
+            job.dependencies.push_back(addSubdocumentJob(jobs, format));
+        }
+        if(printer.m_useCompileCache) {
+            CompileInputs inputs = printer.getCompileInputs();
+            job.isUpToDate = [inputs]{ return inputs.isUpToDate(); };
+            job.onFinish = [inputs](const ProcessResult& result) {
+                if(result.exitStatus == 0)
+                    inputs.stamp();
+            };
+        }
+        job.dependencies.insert(job.dependencies.end(), index.begin(), index.end());
+        addSubdocumentJob(jobs, job);
+    }
+    void buildSubdocuments() const {
+        std::vector<BuildScheduler::Job> jobs = getSubdocumentJobs();
+        m_metrics.subdocuments.clear();
+        if(jobs.empty())
+            return;
+
+        log("Compiling " + std::to_string(jobs.size()) + " subdocuments of " + getTexFilename() + "...\n");
+        auto start = std::chrono::steady_clock::now();
+        BuildScheduler scheduler(m_buildWorkers);
+        for(const auto& job : jobs)
+            scheduler.addJob(job);
+        m_metrics.subdocuments = scheduler.run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        m_metrics.subdocumentSeconds += seconds;
+        if(m_verbose)
+            BuildScheduler::printReport(m_metrics.subdocuments);
+        for(const auto& result : m_metrics.subdocuments) {
+            if(result.skipped) {
+                std::cerr << "Skipped " << result.name << ", which depends on a failed subdocument\n";
+            } else if(!result.upToDate && result.process.exitStatus != 0) {
+                // the compiler and mylatexformat write the log next to the .pdf or .fmt they build
+                CompileReport report = CompileReport::ofLog(result.name.substr(0, result.name.rfind('.')) + ".log");
+                report.process = result.process;
+                reportFailure(result.name, report);
+            }
+        }
+        log("done in " + formatNumber(seconds, {2}) + "s.\n");
+    }
+
+    /** Run the compiler on the saved document, again after capacity failures, and read its log. */
+    CompileReport runCompiler() const {
+        BuildScheduler::Job job;
+        job.command = getCompileCommand();
+        auto retry = getCapacityRetry();
+        std::remove(getLogPath().c_str()); // so a compiler that does not start is not blamed for old errors
+        ProcessResult result;
+        size_t attempts = 0;
+        double seconds = 0;
+        do {
+            result = runProcess(job.command, "/dev/null", m_compileTimeout, job.environment);
+            ++attempts;
+            seconds += result.seconds;
+        } while(result.exitStatus != 0 && retry && retry(job, result));
+
+        CompileReport report = CompileReport::ofLog(getLogPath());
+        report.engine = job.command.front().substr(job.command.front().rfind('/') + 1);
+        report.process = result;
+        report.attempts = attempts;
+        report.seconds = seconds;
+        return report;
+    }
+    /** The retry hook of a compile job of this document, see m_retryOnCapacity; empty if it is off. */
+    std::function<bool(BuildScheduler::Job&, const ProcessResult&)> getCapacityRetry() const {
+        if(!m_retryOnCapacity)
+            return {};
+        std::string logPath = getLogPath();
+        Environment environment = m_capacityEnvironment;
+        std::vector<std::string> fallback;
+        if(!m_fallbackCompiler.empty())
+            fallback = getCompileCommand(m_fallbackCompiler, false);
+        return [logPath, environment, fallback](BuildScheduler::Job& job, const ProcessResult& result) {
+            if(result.timedOut || !CompileReport::ofLog(logPath).capacityExceeded)
+                return false;
+            if(job.environment.empty() && !environment.empty()) {
+                job.environment = environment;
+                return true;
+            }
+            if(!fallback.empty() && job.command != fallback) {
+                job.command = fallback;
+                return true;
+            }
+            return false;
+        };
+    }
+    /** Print a failed compilation and the first errors of its log to stderr, whether or not the printer is verbose. */
+    static void reportFailure(const std::string& name, const CompileReport& report) {
+        const size_t maxErrors = 10;
+        std::cerr << "Compiling " << name << " failed"
+                  << (report.process.timedOut ? ", timed out" : " with status " + std::to_string(report.process.exitStatus))
+                  << (report.attempts > 1 ? " after " + std::to_string(report.attempts) + " runs" : "")
+                  << (report.logPath.empty() ? "" : ", see " + report.logPath) << "\n";
+        for(size_t i=0; i<report.errors.size() && i<maxErrors; ++i)
+            std::cerr << "  " << report.errors[i] << "\n";
+        if(report.errors.size() > maxErrors)
+            std::cerr << "  and " << report.errors.size() - maxErrors << " more errors\n";
+    }
+
+    mutable PrinterMetrics m_metrics; // updated by save and compile, which are const
+    size_t m_generationDepth = 0; // of nested GenerationTimers
+
+    /** Times a call that generates content, unless it is made from within another timed call. */
+    class GenerationTimer {
+    public:
+        explicit GenerationTimer(LatexPrinter& printer)
+            : m_printer(printer) {
+            if(m_printer.m_generationDepth++ == 0)
+                m_start = std::chrono::steady_clock::now();
+        }
+        ~GenerationTimer() {
+            if(--m_printer.m_generationDepth == 0)
+                m_printer.m_metrics.generateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        }
+        GenerationTimer(const GenerationTimer&) = delete;
+        GenerationTimer& operator=(const GenerationTimer&) = delete;
+
+    private:
+        LatexPrinter& m_printer;
+        std::chrono::steady_clock::time_point m_start;
+    };
+    /** Add counts of primitives that a printer keeps outside m_metrics, for speed. */
+    virtual void addPrimitiveCounts(PrinterMetrics&) const {}
+    void log(const std::string& text) const {
+        if(m_verbose)
+            std::cout << text << std::flush;
+    }
+
+    /** Write any files besides the .tex that the document refers to, such as images. */
+    virtual void saveSidecarFiles() const {}
+    /** Paths of the files written by saveSidecarFiles(). */
+    virtual std::vector<std::string> getSidecarFiles() const {
+        return {};
+    }
+
+    std::vector<std::string> m_includedFiles; // files of subdocuments this document includes
+
+    /** Everything a compiled PDF depends on, see m_useCompileCache. */
+    struct CompileInputs {
+        std::string textHash;
+        std::vector<std::string> command;
+        std::vector<std::string> files;
+        std::string pdfPath;
+        std::string stampPath;
+
+        /** Hash the inputs; files are read when this is called, so it sees the latest builds. */
+        std::string key() const {
+            Fnv1aHash hash;
+            hash.update(textHash);
+            for(const auto& argument : command) {
+                hash.update(argument);
+                hash.update("", 1);
+            }
+            for(const auto& file : files) {
+                hash.update(file);
+                std::ifstream in(file, std::ios::binary);
+                char buffer[1 << 16];
+                while(in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+                    hash.update(buffer, static_cast<size_t>(in.gcount()));
+                hash.update(in.is_open() ? "+" : "-");
+            }
+            return hash.hex();
+        }
+        bool isUpToDate() const {
+            std::ifstream pdf(pdfPath), stampFile(stampPath);
+            std::string stamped;
+            return pdf.good() && std::getline(stampFile, stamped) && stamped == key();
+        }
+        void stamp() const {
+            std::ofstream(stampPath) << key() << "\n";
+        }
+    };
+    CompileInputs getCompileInputs() const {
+        Fnv1aHash text;
+        if(m_stream) {
+            text = m_stream->hash;
+        } else {
+            text.update(getFullDocumentText());
+        }
+        CompileInputs inputs{ text.hex(), getCompileCommand(), m_includedFiles,
+                              m_directory + getPdfFilename(), m_directory + m_filename + ".cpptex-cache" };
+        for( const auto& file : getSidecarFiles() )
+            inputs.files.push_back(file);
+        return inputs;
+    }
+    /**
+     * When streaming, write the buffered body content to the file once it outgrows the buffer.
+     * Every call adding content ends here, so content added after endStream() throws instead of
+     * being dropped by save().
+     */
+    void flushBody(bool force = false) {
+        if(m_stream && !isStreaming())
+            throw std::logic_error("flushBody: " + getTexFilename() + " was already written by endStream()");
+        if(isStreaming() && (force || m_body.content.size() >= m_stream->bufferSize)) {
+            writeToStream(m_body.content);
+            m_body.content.clear();
+        }
+    }
+    void writeToStream(const std::string& text) {
+        if(fwrite(text.data(), 1, text.size(), m_stream->file) != text.size())
+            throw std::runtime_error("writeToStream: failed writing " + getTexFilename());
+        m_stream->hash.update(text);
+        m_metrics.bytesWritten += text.size();
+    }
     static std::string expandOptions( const OptionsList& options ) {
         std::string optionsString;
         for( auto& o : options ) {
@@ -1,12 +1,20 @@
 #ifndef CPPTEX_PGFPLOTSPRINTER_H
 #define CPPTEX_PGFPLOTSPRINTER_H
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "TikzPrinter.h"
+#include "parallel.h"
 
 namespace cpptex {
 
@@ -14,8 +22,64 @@ class PgfplotPrinter : public TikzPrinter {
 public:
     typedef std::vector<std::vector<std::pair<double,double>>> ResultMatrix;
 
+    /**
+     * Assigns mark styles to series labels and colors to plots. Each printer has its own context,
+     * so printers can be built on separate threads; printers given the same context draw a label
+     * alike. The context is synchronized, but to keep a shared assignment independent of the order
+     * the printers run in, register the labels up front with addMarkers.
+     */
+    class StyleContext {
+    public:
+        /** Assign a mark style to each label that has none, in order. */
+        void addMarkers(const std::vector<std::string>& labels) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(const auto& label : labels)
+                getMarkerTextLocked(label);
+        }
+        /** Assign mark styles to the labels in order, unless any label has one already. */
+        void addMarkersIfEmpty(const std::vector<std::string>& labels) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_markers.empty())
+                for(const auto& label : labels)
+                    getMarkerTextLocked(label);
+        }
+        std::string getMarkerText(const std::string& label) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return getMarkerTextLocked(label);
+        }
+        std::string getMark() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto currentMark = m_markIndex;
+            m_markIndex = (m_markIndex+1) % Marks.size();
+            return Marks.at(currentMark);
+        }
+        std::string getColor() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto currentColor = m_colorIndex;
+            m_colorIndex = (m_colorIndex+1) % Colors.size();
+            return Colors.at(currentColor);
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::map<std::string,std::string> m_markers;
+        size_t m_markStyleIndex = 0; // a valid index of MarkStyles
+        size_t m_markIndex = 0;      // a valid index of Marks
+        size_t m_colorIndex = 1;     // a valid index of Colors
+
+        const std::string& getMarkerTextLocked(const std::string& label) {
+            auto marker = m_markers.find(label);
+            if(marker == m_markers.end()) {
+                marker = m_markers.emplace(label, MarkStyles[m_markStyleIndex]).first;
+                m_markStyleIndex = (m_markStyleIndex+1) % MarkStyles.size();
+            }
+            return marker->second;
+        }
+    };
+
     PgfplotPrinter(std::string path, std::string documentType = "standalone")
-            : TikzPrinter(path,documentType){
+            : TikzPrinter(path,documentType),
+              m_styleContext(std::make_shared<StyleContext>()) {
         m_body = Body{getTikzHeader("scale=0.55"),
                       "",
                       getTikzFooter() };
@@ -27,6 +91,7 @@ public:
     void plotAxis(const std::string& iv, const PlotMap& results, const double xScale = 1.0, const std::string xScaleUnit= "", const bool isFirst = true) {
 
         assert(abs(xScale) > 0);
+        GenerationTimer timer(*this);
 
 //        if(m_algorithmMarkers.empty())
 //            for(const auto& spannerName : spanner::bdps::ALGORITHM_NAMES) // provides the ordering we want
@@ -64,30 +129,56 @@ public:
 
     void plotAxis(const ResultMatrix& results, const std::vector<std::string>& seriesLabels = {}, std::string xLabel = "", std::string yLabel = "", std::string title = "") {
 
-        if(m_algorithmMarkers.empty())
-            for(const auto& seriesName : seriesLabels) // provides the ordering we want
-                addNewMarker(seriesName);
+        GenerationTimer timer(*this);
+        m_styleContext->addMarkersIfEmpty(seriesLabels); // provides the ordering we want
+        m_dataFiles.clear(); // the plot replaces the previous one, and with it its tables
+        m_dataTables.clear();
 
 
+        // reduce oversized series, one series per worker
+        ResultMatrix downsampled(results.size());
+        if(m_pointBudget > 0) {
+            parallelFor(results.size(), [&](size_t begin, size_t end, size_t) {
+                for(size_t i=begin; i<end; ++i)
+                    if(results[i].size() > m_pointBudget)
+                        downsampled[i] = downsampleSeries(results[i], m_pointBudget);
+            });
+        }
+
         // build axis header
         std::string allPlotsOfAxis = getAxisHeader(results, xLabel, yLabel, title);
 
         // build the plot
         for(unsigned i=0; i<results.size(); ++i ) {
+                const auto& series = downsampled[i].empty() ? results[i] : downsampled[i];
+                m_metrics.primitives["plots"] += 1;
+                m_metrics.primitives["points"] += series.size();
 //            if( results.find(name) != results.end() ) {//spanner::contains(results,name) ) {
 //                const auto &spanner = results.at(name);
-                std::string ivPlot = getPlotHeader(seriesLabels.size()>i ? seriesLabels[i] : "");//
-                for (const auto &level: results[i]) {
-                    auto xValue = std::to_string(level.first);
-                    auto yValue = std::to_string(level.second);
-                    ivPlot += "("
-                               + xValue
-                               + ","
-                               + yValue
-                               + ")\n";
-//                    ivPlot += entry;
+                std::string label = seriesLabels.size()>i ? seriesLabels[i] : "";
+                std::string ivPlot;
+                if(&series != &results[i]) {
+                    ivPlot += "\n% series " + std::to_string(i) + (label.empty() ? "" : " (" + label + ")")
+                            + ": downsampled from " + std::to_string(results[i].size())
+                            + " to " + std::to_string(series.size()) + " points, "
+                            + std::to_string(results[i].size() - series.size()) + " dropped";
+                }
+                if(m_externalData) {
+                    std::string dataFile = m_directory + m_filename + "_series" + std::to_string(i) + ".dat";
+                    m_dataFiles.push_back(dataFile);
+                    m_dataTables.push_back(series);
+                    ivPlot += getPlotOptions(label) + " table {" + dataFile + getPlotFooter();
+                } else {
+                    ivPlot += getPlotHeader(label);
+                    for (const auto &level: series) {
+                        ivPlot += '(';
+                        appendNumber(ivPlot, level.first, m_numberFormat);
+                        ivPlot += ',';
+                        appendNumber(ivPlot, level.second, m_numberFormat);
+                        ivPlot += ")\n";
+                    }
+                    ivPlot += getPlotFooter();
                 }
-                ivPlot += getPlotFooter();
 //                if (isFirst) {
 //                    ivPlot += getLegendEntry(name);
 //                }
@@ -111,6 +202,9 @@ public:
         return legendEntry;
     }
     std::string getPlotHeader(const std::string& label) {
+        return getPlotOptions(label) + " coordinates {\n";
+    }
+    std::string getPlotOptions(const std::string& label) {
         std::string plotHeader = "\n\n\\addplot[";
 
         auto color = getColor();
@@ -119,7 +213,6 @@ public:
                     + getMarkerText(label);
 
         plotHeader += "]";
-        plotHeader += " coordinates {\n";
         return plotHeader;
     }
 
@@ -184,14 +277,14 @@ public:
             axisHeader << "xtick={";
 
             for( auto val : xTicksVec)
-                xTicks += std::to_string(val) + ",";
+                xTicks += formatNumber(val, m_numberFormat) + ",";
 
             xTicks = xTicks.substr( 0, xTicks.size()-1 );
             axisHeader << xTicks << "}, ";
             + "xmin="
-            + std::to_string(xTicksVec.front() - step/2)
+            + formatNumber(xTicksVec.front() - step/2, m_numberFormat)
             + ",xmax="
-            + std::to_string(xTicksVec.back() + step/2);
+            + formatNumber(xTicksVec.back() + step/2, m_numberFormat);
         }
 
         axisHeader << "ylabel near ticks,";
@@ -222,7 +315,7 @@ public:
         std::string xTicks = "";
 
         for( auto level : results.begin()->second ){
-            xTicks += std::to_string(static_cast<double>(level.first) / xScale);
+            appendNumber(xTicks, static_cast<double>(level.first) / xScale, m_numberFormat);
             xTicks += ",";
         }
         xTicks = xTicks.substr( 0, xTicks.size()-1 );
@@ -246,9 +339,9 @@ public:
                       + m_ivNiceNames.at(iv)
                       + "}, legend pos=north west,"
                       + "xmin="
-                      + std::to_string(xMin)
+                      + formatNumber(xMin, m_numberFormat)
                       + ",xmax="
-                      + std::to_string(xMax);
+                      + formatNumber(xMax, m_numberFormat);
 
         axisHeader += "]"; // close axis environment attributes
         return axisHeader;
@@ -262,52 +355,134 @@ public:
         return axisFooter;
     }
 
-private:
-    static std::vector<std::string> MarkStyles;
-    static std::vector<std::string> Marks;
-    static size_t m_markIndex; // a valid index of Marks
-    static std::string getMark() {
-        auto currentMark = m_markIndex;
-        m_markIndex = (m_markIndex+1) % Marks.size();
-        return Marks.at(currentMark);
+    /**
+     * Write each series of plotAxis(const ResultMatrix&, ...) to a <name>_series<i>.dat file next
+     * to the document and read it with \\addplot table, instead of inlining the coordinates. The
+     * files are written by save(), for the series of the last plotAxis call, which replaces the plot.
+     */
+    bool m_externalData = false;
+    /**
+     * When positive, series of plotAxis(const ResultMatrix&, ...) with more points than this are
+     * reduced to this many points with largest-triangle-three-buckets before they are written.
+     */
+    size_t m_pointBudget = 0;
+    /** Mark styles and colors of the plots; assign a shared context to match other printers. */
+    std::shared_ptr<StyleContext> m_styleContext;
+
+    /**
+     * Reduce a series ordered by x to budget points while keeping its visual shape, using the
+     * largest-triangle-three-buckets algorithm in linear time. The first and last points are
+     * kept; from each bucket in between, the point spanning the largest triangle with the last
+     * chosen point and the average of the next bucket is chosen. The result never has more than
+     * budget points: a budget of 2 keeps the end points, and a budget of 1 the first point only.
+     */
+    static std::vector<std::pair<double,double>> downsampleSeries(const std::vector<std::pair<double,double>>& series, size_t budget) {
+        size_t n = series.size();
+        if(budget >= n || n < 3)
+            return series;
+        if(budget < 3)
+            return budget == 2 ? std::vector<std::pair<double,double>>{ series.front(), series.back() }
+                               : std::vector<std::pair<double,double>>(series.begin(), series.begin() + budget);
+
+        std::vector<std::pair<double,double>> sampled;
+        sampled.reserve(budget);
+        sampled.push_back(series.front());
+
+        double bucketSize = static_cast<double>(n - 2) / (budget - 2);
+        size_t chosen = 0;
+        for(size_t bucket=0; bucket<budget-2; ++bucket) {
+            size_t begin = static_cast<size_t>(bucket * bucketSize) + 1,
+                   end = static_cast<size_t>((bucket + 1) * bucketSize) + 1,
+                   nextEnd = std::min(static_cast<size_t>((bucket + 2) * bucketSize) + 1, n);
+
+            double averageX = 0, averageY = 0;
+            for(size_t j=end; j<nextEnd; ++j) {
+                averageX += series[j].first;
+                averageY += series[j].second;
+            }
+            averageX /= std::max<size_t>(nextEnd - end, 1);
+            averageY /= std::max<size_t>(nextEnd - end, 1);
+            if(nextEnd == end) // the last bucket is followed by the last point
+                std::tie(averageX, averageY) = series.back();
+
+            const auto& a = series[chosen];
+            double largestArea = -1;
+            size_t largest = begin;
+            for(size_t j=begin; j<end; ++j) {
+                double area = std::abs((a.first - averageX) * (series[j].second - a.second)
+                                     - (a.first - series[j].first) * (averageY - a.second));
+                if(area > largestArea) {
+                    largestArea = area;
+                    largest = j;
+                }
+            }
+            sampled.push_back(series[largest]);
+            chosen = largest;
+        }
+        sampled.push_back(series.back());
+        return sampled;
+    }
+
+protected:
+    void saveSidecarFiles() const override {
+        for(size_t i=0; i<m_dataFiles.size(); ++i)
+            writeDataTable(m_dataFiles[i], m_dataTables[i]);
+    }
+    std::vector<std::string> getSidecarFiles() const override {
+        return m_dataFiles;
     }
 
-    static std::vector<std::string> Colors;
-    static size_t m_colorIndex;
-    static std::string getColor() {
-        auto currentColor = m_colorIndex;
-        m_colorIndex = (m_colorIndex+1) % Colors.size();
-        return Colors.at(currentColor);
+private:
+    std::vector<std::string> m_dataFiles; // of the current plot, see m_externalData
+    std::vector<std::vector<std::pair<double,double>>> m_dataTables; // the series written to m_dataFiles
+
+    /** Stream a series to a whitespace separated table through a fixed-size buffer. */
+    void writeDataTable(const std::string& filename, const std::vector<std::pair<double,double>>& series) const {
+        FILE *fileOut = fopen(filename.c_str(), "w");
+        if(fileOut == nullptr)
+            throw std::runtime_error("writeDataTable: cannot open " + filename);
+
+        const size_t bufferSize = 1 << 16;
+        std::string buffer = "x y\n";
+        buffer.reserve(bufferSize + 64);
+        bool written = true;
+        for(auto point = series.begin(); point != series.end() && written; ++point) {
+            appendNumber(buffer, point->first, m_numberFormat);
+            buffer += ' ';
+            appendNumber(buffer, point->second, m_numberFormat);
+            buffer += '\n';
+            if(buffer.size() >= bufferSize) {
+                written = fwrite(buffer.data(), 1, buffer.size(), fileOut) == buffer.size();
+                buffer.clear();
+            }
+        }
+        written = written && fwrite(buffer.data(), 1, buffer.size(), fileOut) == buffer.size();
+        written = fclose(fileOut) == 0 && written;
+        if(!written) {
+            std::remove(filename.c_str()); // rather than leave a truncated table for the document to plot
+            throw std::runtime_error("writeDataTable: failed writing " + filename);
+        }
     }
-    static int m_markStyleCurrent;
-    static std::string getMarkStyle() {
-        std::string currentStyle = MarkStyles[m_markStyleCurrent];
-        m_markStyleCurrent = (m_markStyleCurrent+1) % MarkStyles.size();
-        return currentStyle;
+
+    static const std::vector<std::string> MarkStyles;
+    static const std::vector<std::string> Marks;
+    std::string getMark() {
+        return m_styleContext->getMark();
     }
-    static void addNewMarker(const std::string& algorithm) {
-//            string color = getColor();
-        std::string markerText;
-//            markerText += "mark=" + getMark() + ","
-//                    + "mark color=" + color + ","
-//                    + "color=" + color;
-        markerText = getMarkStyle();
-        m_algorithmMarkers[algorithm] = markerText;
+
+    static const std::vector<std::string> Colors;
+    std::string getColor() {
+        return m_styleContext->getColor();
     }
-    static std::map<std::string,std::string> m_algorithmMarkers;
-    static std::string getMarkerText(const std::string& algorithm) {
-        if(m_algorithmMarkers.find(algorithm) == m_algorithmMarkers.end())
-            addNewMarker(algorithm);
-        return m_algorithmMarkers.at(algorithm);
+    std::string getMarkerText(const std::string& algorithm) {
+        return m_styleContext->getMarkerText(algorithm);
     }
 
 
     static std::map<std::string,std::string> m_ivNiceNames;
 }; // class PgfplotsPrinter
 
-int PgfplotPrinter::m_markStyleCurrent = 0;
-std::map<std::string,std::string> PgfplotPrinter::m_algorithmMarkers;
-std::vector<std::string> PgfplotPrinter::MarkStyles = {
+inline const std::vector<std::string> PgfplotPrinter::MarkStyles = {
         "color=black,mark options={fill=black},mark=square*",
         "color=black,mark options={fill=black},mark=pentagon*",
         "color=black,mark options={fill=black},mark=diamond*",
@@ -321,13 +496,13 @@ std::vector<std::string> PgfplotPrinter::MarkStyles = {
         "color=black,mark=triangle",
         "color=black,mark=oplus",
 };
-std::vector<std::string> PgfplotPrinter::Marks = {
+inline const std::vector<std::string> PgfplotPrinter::Marks = {
         "otimes*",
         "oplus*",
         "o", "triangle", "pentagon", "square",  "diamond"
 };
 // Palette generated using https://coolors.co/
-std::vector<std::string> PgfplotPrinter::Colors = {
+inline const std::vector<std::string> PgfplotPrinter::Colors = {
         "000000",
         "2288DD"
 //            "22dddd",
@@ -343,10 +518,8 @@ std::vector<std::string> PgfplotPrinter::Colors = {
         //"f4a261",
 
 };
-size_t PgfplotPrinter::m_markIndex = 0;
-size_t PgfplotPrinter::m_colorIndex = 1;
 
-std::map<std::string,std::string> PgfplotPrinter::m_ivNiceNames = {
+inline std::map<std::string,std::string> PgfplotPrinter::m_ivNiceNames = {
         {"runtime",             "Average execution time (s)"},
         {"degree",              "Maximum observed degree"},
         {"avgDegreePerPoint",           "Average observed degree per spanner"},
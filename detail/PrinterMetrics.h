@@ -0,0 +1,106 @@
+#ifndef CPPTEX_PRINTERMETRICS_H
+#define CPPTEX_PRINTERMETRICS_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BuildScheduler.h"
+#include "CompileReport.h"
+#include "util.h"
+
+namespace cpptex {
+
+/**
+ * What a printer did and how long it took, from its first draw call to its last compile. Times
+ * are wall-clock seconds and accumulate over repeated calls; the compiler fields describe the
+ * last compilation.
+ */
+struct PrinterMetrics {
+    std::string name;                          // path of the .tex file
+    std::map<std::string,size_t> primitives;   // drawn, by type, such as edges or rows
+    size_t bytesWritten = 0;                   // of .tex files, including bodies saved for \input
+    double generateSeconds = 0;                // in draw, plot and tabulate calls
+    double saveSeconds = 0;                    // writing the .tex and its sidecar files
+    double compileSeconds = 0;                 // running the compiler on this document
+    double subdocumentSeconds = 0;             // compiling precompiled subdocuments and tiles
+    size_t compileRuns = 0;                    // compile calls that ran the compiler
+    CompileReport compiler;                    // of the last compilation
+    std::vector<BuildScheduler::JobResult> subdocuments; // of the last compilation
+
+    std::string toJson() const {
+        std::string json = "{\"name\": ";
+        appendJsonString(json, name);
+        json += ", \"primitives\": {";
+        for(auto it = primitives.begin(); it != primitives.end(); ++it) {
+            if(it != primitives.begin())
+                json += ", ";
+            appendJsonString(json, it->first);
+            json += ": " + formatNumber(it->second);
+        }
+        json += "}, \"bytesWritten\": " + formatNumber(bytesWritten)
+              + ", \"seconds\": {\"generate\": " + formatSeconds(generateSeconds)
+              + ", \"save\": " + formatSeconds(saveSeconds)
+              + ", \"compile\": " + formatSeconds(compileSeconds)
+              + ", \"subdocuments\": " + formatSeconds(subdocumentSeconds)
+              + "}, \"compiler\": {\"runs\": " + formatNumber(compileRuns)
+              + ", \"upToDate\": " + (compiler.upToDate ? "true" : "false")
+              + ", \"engine\": ";
+        appendJsonString(json, compiler.engine);
+        json += ", \"attempts\": " + formatNumber(compiler.attempts)
+              + ", \"exitStatus\": " + formatNumber(compiler.process.exitStatus)
+              + ", \"timedOut\": " + (compiler.process.timedOut ? "true" : "false")
+              + ", \"capacityExceeded\": " + (compiler.capacityExceeded ? "true" : "false")
+              + ", \"seconds\": " + formatSeconds(compiler.seconds)
+              + ", \"peakMemoryKb\": " + formatNumber(compiler.process.peakMemoryKb)
+              + ", \"pages\": " + formatNumber(compiler.pages)
+              + ", \"overfullBoxes\": " + formatNumber(compiler.overfullBoxes.size())
+              + ", \"errors\": [";
+        for(size_t i=0; i<compiler.errors.size(); ++i) {
+            if(i > 0)
+                json += ", ";
+            appendJsonString(json, compiler.errors[i]);
+        }
+        json += "]}, \"subdocuments\": [";
+        for(size_t i=0; i<subdocuments.size(); ++i) {
+            const auto& job = subdocuments[i];
+            json += i > 0 ? ", {\"name\": " : "{\"name\": ";
+            appendJsonString(json, job.name);
+            json += std::string(", \"skipped\": ") + (job.skipped ? "true" : "false")
+                  + ", \"upToDate\": " + (job.upToDate ? "true" : "false")
+                  + ", \"runs\": " + formatNumber(job.runs)
+                  + ", \"exitStatus\": " + formatNumber(job.process.exitStatus)
+                  + ", \"timedOut\": " + (job.process.timedOut ? "true" : "false")
+                  + ", \"seconds\": " + formatSeconds(job.process.seconds)
+                  + ", \"peakMemoryKb\": " + formatNumber(job.process.peakMemoryKb) + "}";
+        }
+        json += "]}";
+        return json;
+    }
+
+private:
+    static std::string formatSeconds(double seconds) {
+        return formatNumber(seconds, {6});
+    }
+}; // struct PrinterMetrics
+
+/** Adds the seconds from its construction to its destruction to a total. */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(double& total)
+        : m_total(total), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        m_total += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    double& m_total;
+    std::chrono::steady_clock::time_point m_start;
+}; // class ScopedTimer
+
+} // namespace cpptex
+
+#endif // CPPTEX_PRINTERMETRICS_H
@@ -0,0 +1,376 @@
+#ifndef CPPTEX_RASTERCANVAS_H
+#define CPPTEX_RASTERCANVAS_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cpptex {
+
+/**
+ * An RGB image that antialiased lines and discs are blended into, and that writes itself as a
+ * PNG. Coordinates are in pixels with the origin in the bottom left corner, like TikZ. The PNG
+ * encoder is self-contained: rows are filtered per scanline and compressed with LZ77 and the
+ * fixed Huffman codes of deflate.
+ */
+class RasterCanvas {
+public:
+    typedef std::array<uint8_t,3> Color;
+
+    RasterCanvas(size_t width, size_t height, Color background = {255,255,255})
+        : m_width(std::max<size_t>(width,1)), m_height(std::max<size_t>(height,1)),
+          m_pixels(m_width * m_height * 3) {
+        for(size_t i=0; i<m_pixels.size(); i+=3)
+            std::copy(background.begin(), background.end(), m_pixels.begin() + i);
+    }
+
+    size_t width() const {
+        return m_width;
+    }
+    size_t height() const {
+        return m_height;
+    }
+
+    /**
+     * Draw a line of the given width in pixels. Every pixel column along the major axis gets the
+     * exact vertical extent of the line, so thin lines fade in like Wu lines and thick lines get
+     * soft edges. Lines thinner than a pixel are drawn one pixel wide at reduced intensity.
+     */
+    void drawLine(double x0, double y0, double x1, double y1, double width, const Color& color) {
+        bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+        if(steep) {
+            std::swap(x0, y0);
+            std::swap(x1, y1);
+        }
+        if(x0 > x1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+        if(x1 - x0 <= 0)
+            return; // zero-length
+
+        double gradient = (y1 - y0) / (x1 - x0);
+        double intensity = std::min(width, 1.0);
+        double halfExtent = std::max(width, 1.0) / 2 * std::sqrt(1 + gradient*gradient);
+        double majorLimit = static_cast<double>(steep ? m_height : m_width);
+
+        for(double px = std::max(std::floor(x0), 0.0); px <= x1 && px < majorLimit; ++px) {
+            double from = std::max(px, x0), to = std::min(px + 1, x1);
+            double columnCoverage = to - from;
+            if(columnCoverage <= 0)
+                continue;
+            double center = y0 + gradient * ((from + to)/2 - x0);
+            double low = center - halfExtent, high = center + halfExtent;
+            for(double py = std::floor(low); py < high; ++py) {
+                double coverage = std::min(py + 1, high) - std::max(py, low);
+                auto x = static_cast<long long>(steep ? py : px);
+                auto y = static_cast<long long>(steep ? px : py);
+                blend(x, y, color, coverage * columnCoverage * intensity);
+            }
+        }
+    }
+    /** Fill a disc, with the boundary pixels covered by their distance to the rim. */
+    void fillCircle(double cx, double cy, double radius, const Color& color) {
+        long long xMin = static_cast<long long>(std::floor(cx - radius - 1)),
+                  xMax = static_cast<long long>(std::ceil(cx + radius + 1)),
+                  yMin = static_cast<long long>(std::floor(cy - radius - 1)),
+                  yMax = static_cast<long long>(std::ceil(cy + radius + 1));
+        for(long long y=yMin; y<=yMax; ++y) {
+            for(long long x=xMin; x<=xMax; ++x) {
+                double distance = std::hypot(x + 0.5 - cx, y + 0.5 - cy);
+                blend(x, y, color, std::min(std::max(radius + 0.5 - distance, 0.0), 1.0));
+            }
+        }
+    }
+
+    void savePng(const std::string& filename) const {
+        std::vector<uint8_t> header;
+        appendBigEndian(header, static_cast<uint32_t>(m_width));
+        appendBigEndian(header, static_cast<uint32_t>(m_height));
+        header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit RGB, deflate, adaptive filtering, no interlace
+
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        appendChunk(png, "IHDR", header);
+        appendChunk(png, "IDAT", zlibCompress(filterScanlines()));
+        appendChunk(png, "IEND", {});
+
+        FILE *fileOut = fopen(filename.c_str(), "wb");
+        if(fileOut == nullptr)
+            throw std::runtime_error("savePng: cannot open " + filename);
+        size_t written = fwrite(png.data(), 1, png.size(), fileOut);
+        fclose(fileOut);
+        if(written != png.size())
+            throw std::runtime_error("savePng: failed writing " + filename);
+    }
+
+    /**
+     * The color of a TikZ color expression: a hex color defined with LatexPrinter::defineColor,
+     * an xcolor base color such as red, or a mix of these such as blue!50 or red!30!green.
+     * Anything else throws, since the raster would no longer match the styles it replaces.
+     */
+    static Color parseColor(const std::string& expression) {
+        // c!p!d mixes p percent of c with d, which defaults to white; mixes chain from the left
+        std::array<double,3> mixed = {0,0,0};
+        size_t begin = 0, part = 0;
+        double percent = 100;
+        while(true) {
+            size_t end = expression.find('!', begin);
+            std::string token = expression.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+            if(part % 2 == 1) {
+                char* parsed;
+                percent = std::strtod(token.c_str(), &parsed);
+                if(token.empty() || *parsed != '\0' || percent < 0 || percent > 100)
+                    throw std::invalid_argument("parseColor: bad percentage in " + expression);
+                if(end == std::string::npos)
+                    token = "white";
+            }
+            if(part % 2 == 0 || end == std::string::npos) {
+                std::array<double,3> color = namedColor(token, expression);
+                for(size_t c=0; c<3; ++c)
+                    mixed[c] = part == 0 ? color[c] : mixed[c] * percent / 100 + color[c] * (1 - percent / 100);
+            }
+            if(end == std::string::npos)
+                break;
+            begin = end + 1;
+            ++part;
+        }
+        Color color;
+        for(size_t c=0; c<3; ++c)
+            color[c] = static_cast<uint8_t>(std::lround(mixed[c] * 255));
+        return color;
+    }
+
+private:
+    size_t m_width;
+    size_t m_height;
+    std::vector<uint8_t> m_pixels; // rows top to bottom, as PNG stores them
+
+    /** The components in [0,1] of a hex color or an xcolor base color. */
+    static std::array<double,3> namedColor(const std::string& name, const std::string& expression) {
+        if(name.size() == 6 && name.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos) {
+            std::array<double,3> color;
+            for(size_t i=0; i<3; ++i)
+                color[i] = std::stoi(name.substr(2*i, 2), nullptr, 16) / 255.0;
+            return color;
+        }
+        static const std::pair<const char*,std::array<double,3>> baseColors[] = {
+            {"black", {0,0,0}}, {"blue", {0,0,1}}, {"brown", {.75,.5,.25}}, {"cyan", {0,1,1}},
+            {"darkgray", {.25,.25,.25}}, {"gray", {.5,.5,.5}}, {"green", {0,1,0}},
+            {"lightgray", {.75,.75,.75}}, {"lime", {.75,1,0}}, {"magenta", {1,0,1}},
+            {"olive", {.5,.5,0}}, {"orange", {1,.5,0}}, {"pink", {1,.75,.75}},
+            {"purple", {.75,0,.25}}, {"red", {1,0,0}}, {"teal", {0,.5,.5}},
+            {"violet", {.5,0,.5}}, {"white", {1,1,1}}, {"yellow", {1,1,0}},
+        };
+        for(const auto& base : baseColors) {
+            if(name == base.first)
+                return base.second;
+        }
+        throw std::invalid_argument("parseColor: unknown color " + name + " in " + expression);
+    }
+
+    void blend(long long x, long long y, const Color& color, double alpha) {
+        if(alpha <= 0 || x < 0 || y < 0 || x >= static_cast<long long>(m_width) || y >= static_cast<long long>(m_height))
+            return;
+        alpha = std::min(alpha, 1.0);
+        uint8_t* pixel = &m_pixels[((m_height - 1 - y) * m_width + x) * 3];
+        for(size_t c=0; c<3; ++c)
+            pixel[c] = static_cast<uint8_t>(pixel[c] + (color[c] - pixel[c]) * alpha + 0.5);
+    }
+
+    // PNG encoding
+
+    /** Prefix each row with the filter (none, sub or up) that minimizes its sum of absolute residuals. */
+    std::vector<uint8_t> filterScanlines() const {
+        size_t stride = m_width * 3;
+        std::vector<uint8_t> filtered;
+        filtered.reserve((stride + 1) * m_height);
+        std::array<std::vector<uint8_t>,3> candidates;
+
+        for(size_t row=0; row<m_height; ++row) {
+            const uint8_t* current = &m_pixels[row * stride];
+            const uint8_t* above = row > 0 ? current - stride : nullptr;
+            size_t bestFilter = 0, bestCost = SIZE_MAX;
+            for(size_t filter=0; filter<3; ++filter) {
+                auto& candidate = candidates[filter];
+                candidate.resize(stride);
+                size_t cost = 0;
+                for(size_t i=0; i<stride; ++i) {
+                    uint8_t predictor = filter == 1 ? (i >= 3 ? current[i-3] : 0)
+                                      : filter == 2 ? (above ? above[i] : 0)
+                                      : 0;
+                    candidate[i] = static_cast<uint8_t>(current[i] - predictor);
+                    cost += candidate[i] < 128 ? candidate[i] : 256 - candidate[i];
+                }
+                if(cost < bestCost) {
+                    bestCost = cost;
+                    bestFilter = filter;
+                }
+            }
+            filtered.push_back(static_cast<uint8_t>(bestFilter));
+            filtered.insert(filtered.end(), candidates[bestFilter].begin(), candidates[bestFilter].end());
+        }
+        return filtered;
+    }
+
+    class BitWriter {
+    public:
+        std::vector<uint8_t> bytes;
+
+        void write(uint32_t value, unsigned count) {
+            m_buffer |= static_cast<uint64_t>(value) << m_count;
+            m_count += count;
+            while(m_count >= 8) {
+                bytes.push_back(static_cast<uint8_t>(m_buffer));
+                m_buffer >>= 8;
+                m_count -= 8;
+            }
+        }
+        /** Huffman codes are stored most significant bit first. */
+        void writeCode(uint32_t code, unsigned length) {
+            uint32_t reversed = 0;
+            for(unsigned i=0; i<length; ++i)
+                reversed |= ((code >> i) & 1u) << (length - 1 - i);
+            write(reversed, length);
+        }
+        void finish() {
+            if(m_count > 0)
+                write(0, 8 - m_count);
+        }
+    private:
+        uint64_t m_buffer = 0;
+        unsigned m_count = 0;
+    };
+
+    static void writeLiteral(BitWriter& out, unsigned symbol) {
+        if(symbol < 144)      out.writeCode(0x30 + symbol, 8);
+        else if(symbol < 256) out.writeCode(0x190 + symbol - 144, 9);
+        else if(symbol < 280) out.writeCode(symbol - 256, 7);
+        else                  out.writeCode(0xc0 + symbol - 280, 8);
+    }
+    static void writeMatch(BitWriter& out, unsigned length, unsigned distance) {
+        static const unsigned lengthBase[] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+        static const unsigned lengthExtra[] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+        static const unsigned distanceBase[] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+        static const unsigned distanceExtra[] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+        unsigned code = 28;
+        while(lengthBase[code] > length)
+            --code;
+        writeLiteral(out, 257 + code);
+        out.write(length - lengthBase[code], lengthExtra[code]);
+
+        code = 29;
+        while(distanceBase[code] > distance)
+            --code;
+        out.writeCode(code, 5);
+        out.write(distance - distanceBase[code], distanceExtra[code]);
+    }
+
+    /** A zlib stream holding one deflate block with fixed Huffman codes and hash-chained LZ77 matches. */
+    static std::vector<uint8_t> zlibCompress(const std::vector<uint8_t>& data) {
+        const size_t windowSize = 32768, minMatch = 3, maxMatch = 258, maxChain = 16;
+        const size_t hashBits = 15;
+
+        BitWriter out;
+        out.bytes.reserve(data.size() / 4 + 64);
+        out.bytes = {0x78, 0x01};
+        out.write(1, 1); // final block
+        out.write(1, 2); // fixed Huffman codes
+
+        std::vector<int64_t> head(size_t(1) << hashBits, -1);
+        std::vector<int64_t> previous(windowSize, -1);
+        auto hashAt = [&data](size_t i) {
+            uint32_t v = data[i] | (data[i+1] << 8) | (data[i+2] << 16);
+            return (v * 2654435761u) >> (32 - hashBits);
+        };
+        auto insert = [&](size_t i) {
+            if(i + minMatch > data.size())
+                return;
+            auto h = hashAt(i);
+            previous[i % windowSize] = head[h];
+            head[h] = static_cast<int64_t>(i);
+        };
+
+        size_t i = 0;
+        while(i < data.size()) {
+            size_t bestLength = 0, bestDistance = 0;
+            if(i + minMatch <= data.size()) {
+                int64_t candidate = head[hashAt(i)];
+                size_t limit = std::min(maxMatch, data.size() - i);
+                for(size_t chain=0; candidate >= 0 && chain < maxChain; ++chain) {
+                    size_t distance = i - static_cast<size_t>(candidate);
+                    if(distance > windowSize - 1)
+                        break;
+                    size_t length = 0;
+                    while(length < limit && data[candidate + length] == data[i + length])
+                        ++length;
+                    if(length > bestLength) {
+                        bestLength = length;
+                        bestDistance = distance;
+                        if(length == limit)
+                            break;
+                    }
+                    candidate = previous[candidate % windowSize];
+                }
+            }
+            if(bestLength >= minMatch) {
+                writeMatch(out, static_cast<unsigned>(bestLength), static_cast<unsigned>(bestDistance));
+                for(size_t k=0; k<bestLength; ++k)
+                    insert(i + k);
+                i += bestLength;
+            } else {
+                writeLiteral(out, data[i]);
+                insert(i);
+                ++i;
+            }
+        }
+        writeLiteral(out, 256); // end of block
+        out.finish();
+
+        uint32_t a = 1, b = 0; // adler-32
+        for(uint8_t byte : data) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        appendBigEndian(out.bytes, (b << 16) | a);
+        return out.bytes;
+    }
+
+    static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+        for(int shift=24; shift>=0; shift-=8)
+            out.push_back(static_cast<uint8_t>(value >> shift));
+    }
+    static void appendChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data) {
+        static const std::array<uint32_t,256> crcTable = [] {
+            std::array<uint32_t,256> table{};
+            for(uint32_t n=0; n<256; ++n) {
+                uint32_t c = n;
+                for(int k=0; k<8; ++k)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                table[n] = c;
+            }
+            return table;
+        }();
+
+        appendBigEndian(png, static_cast<uint32_t>(data.size()));
+        size_t crcStart = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+
+        uint32_t crc = 0xffffffffu;
+        for(size_t i=crcStart; i<png.size(); ++i)
+            crc = crcTable[(crc ^ png[i]) & 0xff] ^ (crc >> 8);
+        appendBigEndian(png, crc ^ 0xffffffffu);
+    }
+}; // class RasterCanvas
+
+} // namespace cpptex
+
+#endif // CPPTEX_RASTERCANVAS_H
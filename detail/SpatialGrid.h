@@ -0,0 +1,159 @@
+#ifndef CPPTEX_SPATIALGRID_H
+#define CPPTEX_SPATIALGRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "BoundingBox.h"
+
+namespace cpptex {
+
+/**
+ * A uniform grid over the points or edges of a graph, which finds the ones meeting a rectangle
+ * without looking at the others. Each item is listed in every cell its bounding box overlaps,
+ * except for items spanning more than MaxCellsPerItem cells, such as the rare long edges of a
+ * spanner, which are kept aside and tested on every query. An index is built once per point or
+ * edge set and answers any number of queries, such as the viewports of several zoomed insets.
+ * Items with a NaN or infinite coordinate are left out.
+ */
+class SpatialGrid {
+public:
+    /** Index the points in [begin,end), which have x() and y(). */
+    template<class Iterator>
+    static SpatialGrid ofPoints(Iterator begin, Iterator end, double itemsPerCell = 4) {
+        std::vector<Box> boxes;
+        for(auto p = begin; p != end; ++p)
+            boxes.push_back(Box{ p->x(), p->y(), p->x(), p->y() });
+        return SpatialGrid(std::move(boxes), itemsPerCell);
+    }
+    /** Index the edges in [begin,end), pairs of indices into the points P, as in GraphPrinter::drawEdges. */
+    template<class Iterator, class PointContainer>
+    static SpatialGrid ofEdges(Iterator begin, Iterator end, const PointContainer& P, double itemsPerCell = 4) {
+        std::vector<Box> boxes;
+        for(auto e = begin; e != end; ++e) {
+            const auto& a = P[e->first];
+            const auto& b = P[e->second];
+            boxes.push_back(Box{ std::min<double>(a.x(), b.x()), std::min<double>(a.y(), b.y()),
+                                 std::max<double>(a.x(), b.x()), std::max<double>(a.y(), b.y()) });
+        }
+        return SpatialGrid(std::move(boxes), itemsPerCell);
+    }
+
+    /** The number of items indexed, including those left out. */
+    size_t size() const {
+        return m_boxes.size();
+    }
+    /** The extent of the items in the index. */
+    const BoundingBox& getBounds() const {
+        return m_bounds;
+    }
+    /** The indices of the items whose bounding box meets region, in increasing order. */
+    std::vector<size_t> query(const BoundingBox& region) const {
+        std::vector<size_t> items;
+        if(region.empty() || m_bounds.empty() || region.maxX < m_bounds.minX || region.minX > m_bounds.maxX
+                                              || region.maxY < m_bounds.minY || region.minY > m_bounds.maxY)
+            return items;
+        size_t firstColumn = getColumn(region.minX), lastColumn = getColumn(region.maxX),
+               firstRow = getRow(region.minY), lastRow = getRow(region.maxY);
+        for(size_t row=firstRow; row<=lastRow; ++row) {
+            for(size_t column=firstColumn; column<=lastColumn; ++column) {
+                size_t cell = row*m_columns + column;
+                for(size_t k=m_offsets[cell]; k<m_offsets[cell+1]; ++k) {
+                    const Box& box = m_boxes[m_items[k]];
+                    if(box.maxX < region.minX || box.minX > region.maxX || box.maxY < region.minY || box.minY > region.maxY)
+                        continue;
+                    // report an item spanning several cells only from the first of them in the region
+                    if(column == std::max(firstColumn, getColumn(box.minX)) && row == std::max(firstRow, getRow(box.minY)))
+                        items.push_back(m_items[k]);
+                }
+            }
+        }
+        for(size_t item : m_largeItems) {
+            const Box& box = m_boxes[item];
+            if(!(box.maxX < region.minX || box.minX > region.maxX || box.maxY < region.minY || box.minY > region.maxY))
+                items.push_back(item);
+        }
+        std::sort(items.begin(), items.end());
+        return items;
+    }
+
+private:
+    static constexpr size_t MaxCellsPerItem = 64;
+
+    struct Box {
+        double minX, minY, maxX, maxY;
+    };
+    std::vector<Box> m_boxes;
+    BoundingBox m_bounds;
+    size_t m_columns = 1;
+    size_t m_rows = 1;
+    double m_cellWidth = 1;
+    double m_cellHeight = 1;
+    std::vector<size_t> m_offsets; // of the items of each cell in m_items, by row, then column
+    std::vector<size_t> m_items;
+    std::vector<size_t> m_largeItems; // spanning too many cells to be listed in each
+
+    /** Size the grid for about itemsPerCell items per cell, with cells as square as possible. */
+    SpatialGrid(std::vector<Box> boxes, double itemsPerCell)
+        : m_boxes(std::move(boxes)) {
+        std::vector<bool> listed(m_boxes.size()); // in the cells they overlap
+        for(size_t i=0; i<m_boxes.size(); ++i) {
+            const Box& box = m_boxes[i];
+            listed[i] = std::isfinite(box.minX) && std::isfinite(box.minY) && std::isfinite(box.maxX) && std::isfinite(box.maxY);
+            if(listed[i]) {
+                m_bounds.add(box.minX, box.minY);
+                m_bounds.add(box.maxX, box.maxY);
+            }
+        }
+        double cells = std::max(1.0, m_boxes.size() / std::max(itemsPerCell, 1.0));
+        double width = m_bounds.width(), height = m_bounds.height();
+        if(width > 0 && height > 0) {
+            m_columns = static_cast<size_t>(std::max(1.0, std::ceil(std::sqrt(cells * width / height))));
+            m_rows = static_cast<size_t>(std::max(1.0, std::ceil(cells / m_columns)));
+        } else if(width > 0) {
+            m_columns = static_cast<size_t>(cells);
+        } else if(height > 0) {
+            m_rows = static_cast<size_t>(cells);
+        }
+        m_cellWidth = width > 0 ? width / m_columns : 1;
+        m_cellHeight = height > 0 ? height / m_rows : 1;
+
+        // count the items of each cell, then place them
+        m_offsets.assign(m_columns*m_rows + 1, 0);
+        auto forEachCell = [&](const Box& box, auto f) {
+            for(size_t row=getRow(box.minY); row<=getRow(box.maxY); ++row)
+                for(size_t column=getColumn(box.minX); column<=getColumn(box.maxX); ++column)
+                    f(row*m_columns + column);
+        };
+        for(size_t i=0; i<m_boxes.size(); ++i) {
+            const Box& box = m_boxes[i];
+            if(listed[i] && (getColumn(box.maxX) - getColumn(box.minX) + 1) * (getRow(box.maxY) - getRow(box.minY) + 1) > MaxCellsPerItem) {
+                listed[i] = false;
+                m_largeItems.push_back(i);
+            }
+            if(listed[i])
+                forEachCell(box, [&](size_t cell) { ++m_offsets[cell + 1]; });
+        }
+        for(size_t cell=0; cell+1<m_offsets.size(); ++cell)
+            m_offsets[cell+1] += m_offsets[cell];
+        m_items.resize(m_offsets.back());
+        std::vector<size_t> next(m_offsets.begin(), m_offsets.end() - 1);
+        for(size_t i=0; i<m_boxes.size(); ++i) {
+            if(listed[i])
+                forEachCell(m_boxes[i], [&](size_t cell) { m_items[next[cell]++] = i; });
+        }
+    }
+    size_t getColumn(double x) const {
+        double column = std::floor((x - m_bounds.minX) / m_cellWidth);
+        return static_cast<size_t>(std::max(0.0, std::min(m_columns - 1.0, column)));
+    }
+    size_t getRow(double y) const {
+        double row = std::floor((y - m_bounds.minY) / m_cellHeight);
+        return static_cast<size_t>(std::max(0.0, std::min(m_rows - 1.0, row)));
+    }
+}; // class SpatialGrid
+
+} // namespace cpptex
+
+#endif // CPPTEX_SPATIALGRID_H
@@ -3,12 +3,28 @@
 
 #include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
 #include <map>
+#include <limits>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "LatexPrinter.h"
+#include "parallel.h"
 
 namespace cpptex {
 
@@ -30,102 +46,577 @@ public:
         defineColor(TABLE_COLOR_1);
         defineColor(TABLE_COLOR_2);
     }
+    /** Leave the column at position iv out of the table, and skip it when loading a CSV file. */
     void ignoreIV(unsigned iv) {
         m_ignore.insert(iv);
     }
+    /**
+     * A column of cells, parsed once on ingest into integers or reals when every cell is a
+     * number, and kept as text otherwise, along with the value of each cell that is a number.
+     * Cells are formatted only when the table is emitted. Numbers read from text print as they
+     * were written unless a precision is set: a real keeps the count of decimals it was written
+     * with, and the rare cell whose text does not follow from its value, such as +5 or 1e3, is
+     * kept on the side in writtenTexts.
+     */
+    struct Column {
+        enum Type { Integer, Real, Text };
+
+        std::string header;
+        Type type = Text;
+        std::vector<long long> integers;
+        std::vector<double> reals;      // of a Real column, or of a Text column with numbers, NaN for its other cells
+        std::vector<std::string> texts; // of a Text column
+        std::vector<uint8_t> decimals;  // of a Real column read from text without a precision, as written
+        std::vector<std::pair<size_t,std::string>> writtenTexts; // numbers that print differently, by row
+        int precision = -1; // decimals printed for numbers, or -1 to print them as they are
+
+        Column() = default;
+        Column(std::string header, const std::vector<std::string>& cells, int precision)
+            : header(std::move(header)), precision(precision) {
+            bool integral = true, real = true, anyNumber = false;
+            integers.resize(cells.size());
+            for(size_t i=0; i<cells.size() && integral; ++i)
+                integral = parseCell(cells[i], integers[i]);
+            if(integral) {
+                type = Integer;
+            } else {
+                integers.clear();
+                reals.resize(cells.size());
+                for(size_t i=0; i<cells.size(); ++i) {
+                    bool number = parseCell(cells[i], reals[i]);
+                    if(!number)
+                        reals[i] = std::numeric_limits<double>::quiet_NaN();
+                    real = real && number;
+                    anyNumber = anyNumber || number;
+                }
+                type = real ? Real : Text;
+            }
+            if(type == Text) {
+                texts = cells;
+                if(!anyNumber)
+                    reals.clear();
+            } else if(precision < 0) {
+                if(type == Real)
+                    decimals.resize(cells.size());
+                for(size_t i=0; i<cells.size(); ++i)
+                    if(!keepWritten(i, cells[i]))
+                        writtenTexts.emplace_back(i, cells[i]);
+            }
+        }
+
+        size_t size() const {
+            return type == Integer ? integers.size() : type == Real ? reals.size() : texts.size();
+        }
+        /** Whether some cell is a number. */
+        bool isNumeric() const {
+            return type != Text || !reals.empty();
+        }
+        bool isNumber(size_t row) const {
+            return type != Text || (!reals.empty() && !std::isnan(reals[row]));
+        }
+        /** The value of a number cell as it is printed, i.e. rounded to the precision. */
+        double value(size_t row) const {
+            double v = type == Integer ? static_cast<double>(integers[row]) : reals[row];
+            if(precision < 0 || type == Integer)
+                return v;
+            double scale = std::pow(10.0, precision);
+            return std::round(v * scale) / scale;
+        }
+        void appendCell(std::string& out, size_t row) const {
+            char buffer[512];
+            if(precision >= 0 && isNumber(row)) {
+                // fixed decimals, keeping the zeros so the column lines up
+                double v = type == Integer ? static_cast<double>(integers[row]) : reals[row];
+                out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), v, std::chars_format::fixed, precision).ptr);
+            } else if(type == Text) {
+                out += texts[row];
+            } else if(const std::string* written = findWritten(row)) {
+                out += *written;
+            } else {
+                out += formatWritten(buffer, row);
+            }
+        }
+        /** Append the cell in row of other, a column of the same type, as it was written. */
+        void pushCell(const Column& other, size_t row) {
+            size_t to = size();
+            if(other.type == Integer)
+                integers.push_back(other.integers[row]);
+            if(other.type == Text)
+                texts.push_back(other.texts[row]);
+            if(!other.reals.empty())
+                reals.push_back(other.reals[row]);
+            if(!other.decimals.empty())
+                decimals.push_back(other.decimals[row]);
+            if(const std::string* written = other.findWritten(row))
+                writtenTexts.emplace_back(to, *written);
+        }
+        /**
+         * Record the decimals the number in row was written with in text. Returns false if its
+         * value then prints differently, so text has to be kept in writtenTexts.
+         */
+        bool keepWritten(size_t row, std::string_view text) {
+            if(type == Real) {
+                size_t point = text.find('.');
+                size_t places = point == std::string_view::npos ? 0 : text.size() - point - 1;
+                if(places > MaxWrittenDecimals)
+                    return false;
+                decimals[row] = static_cast<uint8_t>(places);
+            }
+            char buffer[512];
+            return formatWritten(buffer, row) == text;
+        }
+
+    private:
+        static constexpr size_t MaxWrittenDecimals = 30; // keeps every double within the buffer of formatWritten
+
+        const std::string* findWritten(size_t row) const {
+            if(writtenTexts.empty())
+                return nullptr;
+            auto found = std::lower_bound(writtenTexts.begin(), writtenTexts.end(), row,
+                                          [](const std::pair<size_t,std::string>& written, size_t r) { return written.first < r; });
+            return found != writtenTexts.end() && found->first == row ? &found->second : nullptr;
+        }
+        /** The text of a number cell without a precision, with its written decimals if known. */
+        std::string_view formatWritten(char (&buffer)[512], size_t row) const {
+            if(type == Integer)
+                return std::string_view(buffer, std::to_chars(buffer, buffer + sizeof(buffer), integers[row]).ptr - buffer);
+            if(!decimals.empty())
+                return std::string_view(buffer, std::to_chars(buffer, buffer + sizeof(buffer), reals[row], std::chars_format::fixed, decimals[row]).ptr - buffer);
+            std::string text;
+            appendNumber(text, reals[row]);
+            return std::string_view(buffer, text.copy(buffer, sizeof(buffer)));
+        }
+    };
+
     void addColumn(std::string header, const std::vector<std::string>& values, int precision = -1, int priority = -1) {
-        auto valuesCopy(values);
-        SetPrecision precisionSetter{precision};
-        std::transform(valuesCopy.begin(),valuesCopy.end(),valuesCopy.begin(),precisionSetter);
+        addColumn(Column(std::move(header), values, precision), priority);
+    }
+    template<class Number, typename std::enable_if<std::is_arithmetic<Number>::value,int>::type = 0>
+    void addColumn(std::string header, const std::vector<Number>& values, int precision = -1, int priority = -1) {
+        Column column;
+        column.header = std::move(header);
+        column.precision = precision;
+        if(std::is_integral<Number>::value) {
+            column.type = Column::Integer;
+            column.integers.assign(values.begin(), values.end());
+        } else {
+            column.type = Column::Real;
+            column.reals.assign(values.begin(), values.end());
+        }
+        addColumn(std::move(column), priority);
+    }
+    void addColumn(Column column, int priority = -1) {
         if( priority < 0 ) {
             priority = 0;
             while (m_added.find(priority) != m_added.end())//spanner::contains(m_added, priority))
                 ++priority;
         }
-        m_added.emplace(priority,make_pair(header,valuesCopy));
+        m_added.emplace(priority,std::move(column));
     }
-    void tabulate(bool sideways = false, TablePrinter::CellHighlightStyle highlightStyle = TablePrinter::CellHighlightStyle::None) {
-        m_body = Body{getTableHeader(sideways),
-                      getTableBody(highlightStyle),
-                      getTableFooter(sideways) };
+    /**
+     * Add the columns of a CSV file whose first line holds the headers, which are renamed through
+     * m_ivNiceNames. If columns is empty every CSV column is loaded, CSV column i going to position
+     * i after the existing columns; otherwise only the named columns are loaded, in that order.
+     * Positions passed to ignoreIV are neither parsed nor added.
+     *
+     * The file is memory-mapped and split into runs of whole lines that are parsed on up to
+     * maxThreads threads, straight into integer, real or text columns. Quoted cells may contain
+     * the delimiter and doubled quotes, but not line breaks.
+     */
+    void loadCsv(const std::string& path, const std::vector<std::string>& columns = {}, char delimiter = ',',
+                 int precision = -1, unsigned maxThreads = 0) {
+        GenerationTimer timer(*this);
+        MappedFile file(path);
+        const char* begin = file.data;
+        const char* end = file.data + file.size;
+        if(end - begin >= 3 && std::string_view(begin, 3) == "\xEF\xBB\xBF")
+            begin += 3; // UTF-8 byte order mark
+        if(begin == end)
+            throw std::runtime_error("loadCsv: " + path + " has no header line");
+
+        // headers, and the table position of each loaded CSV column
+        const char* lineEnd = std::find(begin, end, '\n');
+        std::vector<std::string_view> headerCells;
+        splitCsvLine(begin, lineEnd, delimiter, headerCells);
+        std::vector<std::string> headers(headerCells.size());
+        for(size_t i=0; i<headerCells.size(); ++i)
+            unquoteCell(headerCells[i], headers[i]);
+        const char* dataBegin = lineEnd == end ? end : lineEnd + 1;
+
+        int firstPosition = m_added.empty() ? 0 : m_added.rbegin()->first + 1;
+        std::vector<size_t> fields;  // CSV column of each loaded column
+        std::vector<int> positions;  // table position of each loaded column
+        auto select = [&](size_t field, size_t index) {
+            int position = firstPosition + static_cast<int>(index);
+            if(m_ignore.count(position) == 0) {
+                fields.push_back(field);
+                positions.push_back(position);
+            }
+        };
+        if(columns.empty()) {
+            for(size_t i=0; i<headers.size(); ++i)
+                select(i, i);
+        } else {
+            for(size_t i=0; i<columns.size(); ++i) {
+                auto found = std::find(headers.begin(), headers.end(), columns[i]);
+                if(found == headers.end())
+                    throw std::invalid_argument("loadCsv: " + path + " has no column " + columns[i]);
+                select(found - headers.begin(), i);
+            }
+        }
+
+        // split the rows into runs of whole lines, one per thread
+        std::vector<const char*> bounds{dataBegin};
+        size_t runs = parallelChunkCount(end - dataBegin, maxThreads, 1 << 20);
+        for(size_t i=1; i<runs; ++i) {
+            const char* bound = std::max(bounds.back(), dataBegin + (end - dataBegin) * i / runs);
+            bound = std::find(bound, end, '\n');
+            bounds.push_back(bound == end ? end : bound + 1);
+        }
+        bounds.push_back(end);
+
+        // pass 1: find the cells of each run and whether each column is integral, real or has numbers
+        struct Run {
+            std::vector<std::vector<std::string_view>> cells;
+            std::vector<char> integral, real, anyNumber;
+            std::vector<std::vector<std::pair<size_t,std::string>>> writtenTexts; // per column, in pass 2
+            size_t firstRow = 0;
+        };
+        std::vector<Run> parsed(bounds.size() - 1);
+        parallelFor(parsed.size(), [&](size_t first, size_t last, size_t) {
+            std::vector<std::string_view> line;
+            for(size_t r=first; r<last; ++r) {
+                Run& run = parsed[r];
+                run.cells.resize(fields.size());
+                size_t lines = std::count(bounds[r], bounds[r+1], '\n') + 1;
+                for(auto& cells : run.cells)
+                    cells.reserve(lines);
+                run.integral.assign(fields.size(), true);
+                run.real.assign(fields.size(), true);
+                run.anyNumber.assign(fields.size(), false);
+                for(const char* p = bounds[r]; p < bounds[r+1]; ) {
+                    const char* next = std::find(p, bounds[r+1], '\n');
+                    splitCsvLine(p, next, delimiter, line);
+                    p = next == bounds[r+1] ? next : next + 1;
+                    if(line.size() == 1 && line[0].empty())
+                        continue; // blank line
+                    for(size_t c=0; c<fields.size(); ++c) {
+                        std::string_view cell = fields[c] < line.size() ? line[fields[c]] : std::string_view();
+                        run.cells[c].push_back(cell);
+                        if(run.integral[c]) {
+                            long long integer;
+                            run.integral[c] = parseCell(cell, integer);
+                        }
+                        if(run.integral[c]) {
+                            run.anyNumber[c] = true;
+                        } else if(run.real[c] || !run.anyNumber[c]) {
+                            double real;
+                            bool number = parseCell(cell, real);
+                            run.real[c] = run.real[c] && number;
+                            run.anyNumber[c] = run.anyNumber[c] || number;
+                        }
+                    }
+                }
+            }
+        }, maxThreads);
+
+        // pass 2: settle each column's type and convert the cells in place
+        std::vector<Column> loaded(fields.size());
+        size_t rows = 0;
+        for(Run& run : parsed) {
+            run.firstRow = rows;
+            rows += run.cells.empty() ? 0 : run.cells[0].size();
+        }
+        for(size_t c=0; c<fields.size(); ++c) {
+            Column& column = loaded[c];
+            std::string header(headers[fields[c]]);
+            auto nice = m_ivNiceNames.find(header);
+            column.header = nice == m_ivNiceNames.end() ? header : nice->second;
+            column.precision = precision;
+            bool integral = true, real = true, anyNumber = false;
+            for(const Run& run : parsed) {
+                integral = integral && run.integral[c];
+                real = real && run.real[c];
+                anyNumber = anyNumber || run.anyNumber[c];
+            }
+            column.type = integral ? Column::Integer : real ? Column::Real : Column::Text;
+            if(column.type == Column::Integer)
+                column.integers.resize(rows);
+            else if(column.type == Column::Real || anyNumber)
+                column.reals.resize(rows);
+            if(column.type == Column::Text)
+                column.texts.resize(rows);
+            else if(column.type == Column::Real && precision < 0)
+                column.decimals.resize(rows);
+        }
+        parallelFor(parsed.size(), [&](size_t first, size_t last, size_t) {
+            for(size_t r=first; r<last; ++r) {
+                parsed[r].writtenTexts.resize(fields.size());
+                for(size_t c=0; c<fields.size(); ++c) {
+                    Column& column = loaded[c];
+                    const auto& cells = parsed[r].cells[c];
+                    size_t row = parsed[r].firstRow;
+                    for(size_t i=0; i<cells.size(); ++i, ++row) {
+                        if(column.type == Column::Text) {
+                            unquoteCell(cells[i], column.texts[row]);
+                            if(!column.reals.empty() && !parseCell(cells[i], column.reals[row]))
+                                column.reals[row] = std::numeric_limits<double>::quiet_NaN();
+                            continue;
+                        }
+                        if(column.type == Column::Integer)
+                            parseCell(cells[i], column.integers[row]);
+                        else
+                            parseCell(cells[i], column.reals[row]);
+                        if(precision < 0 && !column.keepWritten(row, stripQuotes(cells[i])))
+                            parsed[r].writtenTexts[c].emplace_back(row, stripQuotes(cells[i]));
+                    }
+                }
+            }
+        }, maxThreads);
+        for(Run& run : parsed) {
+            for(size_t c=0; c<fields.size(); ++c) {
+                auto& written = loaded[c].writtenTexts;
+                written.insert(written.end(), std::make_move_iterator(run.writtenTexts[c].begin()),
+                               std::make_move_iterator(run.writtenTexts[c].end()));
+            }
+        }
+
+        for(size_t c=0; c<loaded.size(); ++c)
+            addColumn(std::move(loaded[c]), positions[c]);
     }
-    std::string getTableBody(TablePrinter::CellHighlightStyle highlightStyle) {
-        assert(!m_added.empty());
-        typedef TablePrinter::CellHighlightStyle CellHighlightStyle;
+    enum Statistic { Mean, StdDev, Min, Max, Median, Count };
 
-        std::string table;
-        size_t numRows = m_added.begin()->second.second.size();
+    /** A summary column computed by aggregate(). */
+    struct Aggregate {
+        std::string column;  // header of the raw column
+        Statistic statistic;
+        int precision = -1;
+        std::string header;  // defaults to the statistic's name followed by the raw column's header
+    };
 
-        std::vector<std::string> highlightCols;
-        if(highlightStyle==CellHighlightStyle::MaxInColumn) {
-            // first column has algorithm names, skip
-            std::transform(next(m_added.begin()),m_added.end(),back_inserter(highlightCols),
-                [](const auto& column) -> std::string {
+    /**
+     * Replace the raw rows of the table, e.g. one row per trial, by one row per distinct
+     * combination of the key columns, in order of first appearance, followed by the aggregates of
+     * each group. Columns are found by their header or by their name in m_ivNiceNames. Rows are
+     * split over up to maxThreads threads that keep running (Welford) statistics per group; only
+     * medians keep the values. Ignored positions refer to the raw columns, so they are cleared.
+     */
+    void aggregate(const std::vector<std::string>& keys, const std::vector<Aggregate>& aggregates, unsigned maxThreads = 0) {
+        GenerationTimer timer(*this);
+        std::vector<const Column*> keyColumns;
+        for(const auto& key : keys)
+            keyColumns.push_back(&findColumn(key));
 
-                    return *min_element(column.second.second.cbegin(),column.second.second.cend(),
-                        []( const auto& lhs, const auto& rhs ) -> bool {
-                            return stod(lhs) < stod(rhs);
-                    });
-            });
+        // each raw column is accumulated once, however many statistics use it
+        std::vector<const Column*> valueColumns;
+        std::vector<size_t> valueOf;
+        std::vector<char> keepSamples;
+        for(const auto& aggregate : aggregates) {
+            const Column* column = &findColumn(aggregate.column);
+            if(column->type == Column::Text && aggregate.statistic != Count)
+                throw std::invalid_argument("aggregate: column " + aggregate.column + " is not numeric");
+            size_t v = std::find(valueColumns.begin(), valueColumns.end(), column) - valueColumns.begin();
+            if(v == valueColumns.size()) {
+                valueColumns.push_back(column);
+                keepSamples.push_back(false);
+            }
+            keepSamples[v] = keepSamples[v] || aggregate.statistic == Median;
+            valueOf.push_back(v);
         }
-        for(size_t row=0; row<numRows; ++row) {
-            std::string highlightValue;
-            if(highlightStyle==CellHighlightStyle::MaxInRow) {
-                // first column has n levels, skip
-                highlightValue = min_element(next(m_added.begin()),m_added.end(),
-              [row](auto &column1, auto &column2){
-                        return stod(column1.second.second.at(row)) < stod(column2.second.second.at(row));
-                    })->second.second.at(row);
-            }
-            int columnNum = -1; // 0 is the first index of the column highlight-data but we want to skip the first col (names)
-            for(const auto& cell : m_added ) { //auto attr : colHeaders )
-                std::string cellValue = cell.second.second.at(row);
-                std::string prefix = "$";
-                std::string suffix = "$ &";
-                if( highlightValue == cellValue
-                  ||(!highlightCols.empty() && highlightCols[columnNum] == cellValue )) {
-                    prefix += "\\textbf{";
-                    suffix = "}" + suffix;
+
+        size_t rows = !keyColumns.empty() ? keyColumns[0]->size() : !valueColumns.empty() ? valueColumns[0]->size() : 0;
+        for(const Column* column : keyColumns)
+            if(column->size() != rows)
+                throw std::invalid_argument("aggregate: column " + column->header + " has a different number of rows");
+        for(const Column* column : valueColumns)
+            if(column->size() != rows)
+                throw std::invalid_argument("aggregate: column " + column->header + " has a different number of rows");
+
+        // groups are identified by their first row
+        auto hashRow = [&](size_t row) {
+            size_t hash = 0;
+            for(const Column* column : keyColumns) {
+                size_t cell = column->type == Column::Integer ? std::hash<long long>()(column->integers[row])
+                            : column->type == Column::Real ? std::hash<double>()(column->reals[row])
+                            : std::hash<std::string>()(column->texts[row]);
+                hash ^= cell + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+            }
+            return hash;
+        };
+        auto sameKey = [&](size_t a, size_t b) {
+            for(const Column* column : keyColumns) {
+                bool same = column->type == Column::Integer ? column->integers[a] == column->integers[b]
+                          : column->type == Column::Real ? column->reals[a] == column->reals[b]
+                          : column->texts[a] == column->texts[b];
+                if(!same)
+                    return false;
+            }
+            return true;
+        };
+        typedef std::unordered_map<size_t,size_t,decltype(hashRow),decltype(sameKey)> GroupIndex;
+        auto rawValue = [](const Column* column, size_t row) {
+            return column->type == Column::Integer ? static_cast<double>(column->integers[row])
+                 : column->type == Column::Real ? column->reals[row] : 0.0;
+        };
+
+        // accumulate each run of rows into its own groups, in order of first appearance
+        std::vector<std::vector<Group>> partials(parallelChunkCount(rows, maxThreads, 1 << 16));
+        parallelFor(rows, [&](size_t first, size_t last, size_t chunk) {
+            std::vector<Group>& groups = partials[chunk];
+            GroupIndex index(16, hashRow, sameKey);
+            for(size_t row=first; row<last; ++row) {
+                auto found = index.try_emplace(row, groups.size()); // builds a node only for a new group
+                if(found.second)
+                    groups.push_back(Group(row, valueColumns.size()));
+                Group& group = groups[found.first->second];
+                for(size_t v=0; v<valueColumns.size(); ++v) {
+                    double x = rawValue(valueColumns[v], row);
+                    group.statistics[v].add(x);
+                    if(keepSamples[v])
+                        group.samples[v].push_back(x);
                 }
-                table += prefix + cellValue + suffix;
+            }
+        }, maxThreads, 1 << 16);
 
-                ++columnNum;
+        // merge the runs in order, so the groups stay in order of first appearance
+        std::vector<Group> groups;
+        GroupIndex index(16, hashRow, sameKey);
+        for(auto& partial : partials) {
+            for(auto& group : partial) {
+                auto found = index.try_emplace(group.row, groups.size());
+                if(found.second) {
+                    groups.push_back(std::move(group));
+                    continue;
+                }
+                Group& into = groups[found.first->second];
+                for(size_t v=0; v<valueColumns.size(); ++v) {
+                    into.statistics[v].merge(group.statistics[v]);
+                    into.samples[v].insert(into.samples[v].end(), group.samples[v].begin(), group.samples[v].end());
+                }
             }
-            table = table.substr(0, table.size() - 1 ); // remove trailing character (&)
-            table += "\\\\\n\n";
         }
+        parallelFor(groups.size(), [&](size_t first, size_t last, size_t) {
+            for(size_t g=first; g<last; ++g)
+                for(size_t v=0; v<valueColumns.size(); ++v)
+                    if(keepSamples[v])
+                        groups[g].statistics[v].median = median(groups[g].samples[v]);
+        }, maxThreads);
+
+        // one row per group: the keys, then the aggregates
+        std::vector<Column> summary;
+        for(const Column* key : keyColumns) {
+            Column column;
+            column.header = key->header;
+            column.type = key->type;
+            column.precision = key->precision;
+            for(const Group& group : groups)
+                column.pushCell(*key, group.row);
+            summary.push_back(std::move(column));
+        }
+        for(size_t a=0; a<aggregates.size(); ++a) {
+            const Aggregate& aggregate = aggregates[a];
+            Column column;
+            column.header = !aggregate.header.empty() ? aggregate.header
+                          : getStatisticName(aggregate.statistic) + " " + valueColumns[valueOf[a]]->header;
+            column.type = aggregate.statistic == Count ? Column::Integer : Column::Real;
+            column.precision = aggregate.precision;
+            for(const Group& group : groups) {
+                const RunningStatistics& statistics = group.statistics[valueOf[a]];
+                if(aggregate.statistic == Count)
+                    column.integers.push_back(statistics.count);
+                else
+                    column.reals.push_back(statistics.get(aggregate.statistic));
+            }
+            summary.push_back(std::move(column));
+        }
+
+        m_added.clear();
+        m_ignore.clear();
+        for(auto& column : summary)
+            addColumn(std::move(column));
+    }
+    static std::string getStatisticName(Statistic statistic) {
+        static const char* names[] = {"mean", "stddev", "min", "max", "median", "count"};
+        return names[statistic];
+    }
+
+    /**
+     * Emit a longtable instead of a tabular, so large tables break across pages and neither the
+     * printer nor TeX holds the whole table in one box. The column headers repeat on every page.
+     * A longtable needs a paginated document, so the printer must be constructed with a document
+     * type such as "article" rather than the default standalone; sideways is ignored. tabulate()
+     * adds the longtable package to m_packages, which has to be done before beginStream() when
+     * streaming.
+     */
+    bool m_longtable = false;
+
+    /**
+     * Build the table in a single pass. When the printer is streaming, rows are flushed to the
+     * file as they are formatted, and the table footer is written by endStream().
+     */
+    void tabulate(bool sideways = false, TablePrinter::CellHighlightStyle highlightStyle = TablePrinter::CellHighlightStyle::None) {
+        GenerationTimer timer(*this);
+        if(m_stream && !isStreaming())
+            throw std::logic_error("tabulate: " + getTexFilename() + " was already written by endStream()");
+        if(m_longtable && m_documentType == "standalone")
+            throw std::logic_error("tabulate: a longtable needs a paginated document type such as article, not standalone");
+        if(m_longtable && !m_packages.count("longtable")) {
+            if(m_stream)
+                throw std::logic_error("tabulate: add longtable to m_packages before beginStream() to stream a longtable");
+            m_packages.insert("longtable");
+        }
+        if(isStreaming()) {
+            addRawText(getTableHeader(sideways));
+        } else {
+            m_body = Body{getTableHeader(sideways), "", ""};
+        }
+        appendTableBody(m_body.content, highlightStyle, true);
+        m_body.footer = getTableFooter(sideways);
+
+        std::vector<const Column*> columns = getColumns();
+        m_metrics.primitives["rows"] += columns.front()->size();
+        m_metrics.primitives["cells"] += columns.front()->size() * columns.size();
+    }
+    std::string getTableBody(TablePrinter::CellHighlightStyle highlightStyle) {
+        std::string table;
+        appendTableBody(table, highlightStyle, false);
         return table;
     }
     std::string getTableHeader(bool sideways = false) {
+        sideways = sideways && !m_longtable;
 
         std::string tableHeader = "\\rowcolors{1}{"
                                   + TABLE_COLOR_1 + "}{"
                                   + TABLE_COLOR_2 + "}\n\n"
                                   + (sideways ? "\\begin{sidewaystable}\n\n" : "")
-                                  + "\\begin{tabular}{|";
-        unsigned tableCols = m_added.size();
-        tableCols -= m_ignore.size();
-        assert(m_added.size()>m_ignore.size());
-        for( unsigned i=0; i<tableCols; ++i ){
+                                  + (m_longtable ? "\\begin{longtable}{|" : "\\begin{tabular}{|");
+        std::vector<const Column*> columns = getColumns();
+        assert(!columns.empty());
+        for( unsigned i=0; i<columns.size(); ++i ){
             tableHeader += "c|";
         }
         tableHeader += "}\n";
         tableHeader += "\\hline\n\n";
 
-
-        //for(int cell = 0; cell < (int) m_added.size(); ++cell) { //auto attr : colHeaders )
-        for( auto column : m_added ){
-            tableHeader += column.second.first + " & ";
+        for( auto column = columns.begin(); column != columns.end(); ++column ){
+            if( column != columns.begin() )
+                tableHeader += "& ";
+            tableHeader += (*column)->header + " ";
         }
-
-        tableHeader = tableHeader.substr( 0, tableHeader.size()-2 ); // remove trailing character (&)
         tableHeader += "\\\\";
 
         tableHeader += "\n\n\\hline\n";
         tableHeader += "\n\n\\hline\n";
+        if(m_longtable) {
+            tableHeader += "\\endhead\n"
+                           "\\hline\n"
+                           "\\endfoot\n\n";
+        }
         return tableHeader;
     }
     std::string getTableFooter(bool sideways = false) {
+        if(m_longtable)
+            return "\\end{longtable}\n\n";
         std::string tableFooter = std::string("")
                                   + "\\hline\n"
                                   + "\\end{tabular}\n\n"
@@ -134,12 +625,220 @@ public:
     }
     static std::map<std::string,std::string> m_ivNiceNames;
 protected:
+    /** Append the table rows to out, flushing after each row when out is the streamed body. */
+    void appendTableBody(std::string& table, TablePrinter::CellHighlightStyle highlightStyle, bool flushRows) {
+        typedef TablePrinter::CellHighlightStyle CellHighlightStyle;
+
+        // the first column has the row names, so it is never highlighted
+        std::vector<const Column*> columns = getColumns();
+        assert(!columns.empty());
+        size_t numRows = columns.front()->size();
+
+        const double none = std::numeric_limits<double>::quiet_NaN(); // compares unequal to everything
+        std::vector<double> highlightCols(columns.size(), none);
+        if(highlightStyle==CellHighlightStyle::MaxInColumn) {
+            for(size_t col=1; col<columns.size(); ++col) {
+                if(!columns[col]->isNumeric())
+                    continue;
+                for(size_t row=0; row<numRows; ++row)
+                    if(columns[col]->isNumber(row) && !(columns[col]->value(row) >= highlightCols[col]))
+                        highlightCols[col] = columns[col]->value(row);
+            }
+        }
+        for(size_t row=0; row<numRows; ++row) {
+            double highlightValue = none;
+            if(highlightStyle==CellHighlightStyle::MaxInRow) {
+                for(size_t col=1; col<columns.size(); ++col)
+                    if(columns[col]->isNumber(row) && !(columns[col]->value(row) >= highlightValue))
+                        highlightValue = columns[col]->value(row);
+            }
+            for(size_t col=0; col<columns.size(); ++col) {
+                const Column& cell = *columns[col];
+                bool highlight = col > 0 && cell.isNumber(row)
+                              && (cell.value(row) == highlightValue || cell.value(row) == highlightCols[col]);
+                if(col > 0)
+                    table += '&';
+                table += highlight ? "$\\textbf{" : "$";
+                cell.appendCell(table, row);
+                table += highlight ? "}$ " : "$ ";
+            }
+            table += "\\\\\n\n";
+            if(flushRows)
+                flushBody();
+        }
+    }
+
+    /** The columns that are printed, in order. */
+    std::vector<const Column*> getColumns() const {
+        std::vector<const Column*> columns;
+        for(const auto& column : m_added)
+            if(column.first < 0 || m_ignore.count(column.first) == 0)
+                columns.push_back(&column.second);
+        return columns;
+    }
+
     std::set<unsigned> m_ignore;
-    std::map<int,std::pair<std::string,std::vector<std::string>>> m_added;
+    std::map<int,Column> m_added;
+
+private:
+    /** Running count, mean, variance and extrema of a stream of values (Welford's algorithm). */
+    struct RunningStatistics {
+        size_t count = 0;
+        double mean = 0;
+        double m2 = 0; // sum of squared deviations from the mean
+        double min = std::numeric_limits<double>::infinity();
+        double max = -std::numeric_limits<double>::infinity();
+        double median = std::numeric_limits<double>::quiet_NaN(); // filled in from the samples
+
+        void add(double x) {
+            ++count;
+            double delta = x - mean;
+            mean += delta / count;
+            m2 += delta * (x - mean);
+            min = std::min(min, x);
+            max = std::max(max, x);
+        }
+        /** Combine with the statistics of another run of values (Chan et al.). */
+        void merge(const RunningStatistics& other) {
+            if(other.count == 0)
+                return;
+            size_t total = count + other.count;
+            double delta = other.mean - mean;
+            mean += delta * other.count / total;
+            m2 += other.m2 + delta * delta * count * other.count / total;
+            count = total;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+        double get(Statistic statistic) const {
+            switch(statistic) {
+                case Mean:   return mean;
+                case StdDev: return count > 1 ? std::sqrt(m2 / (count - 1)) : 0.0;
+                case Min:    return min;
+                case Max:    return max;
+                case Median: return median;
+                case Count:  return static_cast<double>(count);
+            }
+            return mean;
+        }
+    };
+    struct Group {
+        size_t row; // the first row of the group
+        std::vector<RunningStatistics> statistics;
+        std::vector<std::vector<double>> samples;
+
+        Group(size_t row, size_t values) : row(row), statistics(values), samples(values) {}
+    };
+    static double median(std::vector<double>& samples) {
+        if(samples.empty())
+            return std::numeric_limits<double>::quiet_NaN();
+        auto middle = samples.begin() + samples.size() / 2;
+        std::nth_element(samples.begin(), middle, samples.end());
+        if(samples.size() % 2 == 1)
+            return *middle;
+        return (*middle + *std::max_element(samples.begin(), middle)) / 2;
+    }
+    const Column& findColumn(const std::string& name) const {
+        auto nice = m_ivNiceNames.find(name);
+        for(const auto& column : m_added) {
+            if(column.second.header == name || (nice != m_ivNiceNames.end() && column.second.header == nice->second))
+                return column.second;
+        }
+        throw std::invalid_argument("aggregate: no column " + name);
+    }
+
+    /** A read-only memory mapping of a whole file. */
+    struct MappedFile {
+        const char* data = nullptr;
+        size_t size = 0;
+
+        explicit MappedFile(const std::string& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            struct stat status{};
+            if(fd < 0 || fstat(fd, &status) != 0) {
+                if(fd >= 0)
+                    close(fd);
+                throw std::runtime_error("loadCsv: cannot open " + path);
+            }
+            size = status.st_size;
+            if(size > 0) {
+                void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapped == MAP_FAILED) {
+                    close(fd);
+                    throw std::runtime_error("loadCsv: cannot map " + path);
+                }
+                madvise(mapped, size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(mapped);
+            }
+            close(fd);
+        }
+        ~MappedFile() {
+            if(data)
+                munmap(const_cast<char*>(data), size);
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+    };
+
+    /** Split [begin,end) into cells. Quoted cells keep their quotes; unquoteCell drops them. */
+    static void splitCsvLine(const char* begin, const char* end, char delimiter, std::vector<std::string_view>& cells) {
+        cells.clear();
+        if(end > begin && end[-1] == '\r')
+            --end;
+        const char* p = begin;
+        while(true) {
+            const char* cellEnd;
+            if(p < end && *p == '"') {
+                const char* q = p + 1;
+                while(q < end && !(*q == '"' && (q + 1 == end || q[1] != '"')))
+                    q += *q == '"' ? 2 : 1;
+                cells.emplace_back(p, std::min(q + 1, end) - p);
+                cellEnd = std::find(std::min(q, end), end, delimiter);
+            } else {
+                cellEnd = std::find(p, end, delimiter);
+                cells.emplace_back(p, cellEnd - p);
+            }
+            if(cellEnd == end)
+                break;
+            p = cellEnd + 1;
+        }
+    }
+    /** The cell without the quotes around it, if it is quoted. */
+    static std::string_view stripQuotes(std::string_view cell) {
+        if(!cell.empty() && cell.front() == '"') {
+            cell.remove_prefix(1);
+            if(!cell.empty() && cell.back() == '"')
+                cell.remove_suffix(1);
+        }
+        return cell;
+    }
+    /** Parse a whole cell as a number, allowing surrounding blanks and a plus sign like std::stod. */
+    template<class Number>
+    static bool parseCell(std::string_view cell, Number& value) {
+        cell = stripQuotes(cell);
+        while(!cell.empty() && (cell.front() == ' ' || cell.front() == '\t'))
+            cell.remove_prefix(1);
+        while(!cell.empty() && (cell.back() == ' ' || cell.back() == '\t'))
+            cell.remove_suffix(1);
+        if(cell.size() > 1 && cell.front() == '+' && cell[1] != '+' && cell[1] != '-')
+            cell.remove_prefix(1);
+        const char* end = cell.data() + cell.size();
+        auto result = std::from_chars(cell.data(), end, value);
+        return !cell.empty() && result.ec == std::errc() && result.ptr == end;
+    }
+    /** The text of a cell: a quoted cell loses its quotes and has doubled quotes undone, others are kept as they are. */
+    static void unquoteCell(std::string_view cell, std::string& text) {
+        std::string_view inner = stripQuotes(cell);
+        text.assign(inner.data(), inner.size());
+        if(inner.size() == cell.size())
+            return;
+        for(size_t quote = text.find("\"\""); quote != std::string::npos; quote = text.find("\"\"", quote + 1))
+            text.erase(quote, 1);
+    }
 
 };
 
-std::map<std::string,std::string> TablePrinter::m_ivNiceNames = {
+inline std::map<std::string,std::string> TablePrinter::m_ivNiceNames = {
         {"runtime",             "$\\mathrm{runtime (s)}$"},
         {"degree",              "$\\Delta$"},
         {"degreeAvg",           "$\\Delta_\\mathrm{avg}$"},
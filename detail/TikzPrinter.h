@@ -4,8 +4,11 @@
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <map>
 #include <string>
+#include <vector>
 
+#include "BoundingBox.h"
 #include "LatexPrinter.h"
 
 namespace cpptex {
@@ -26,11 +29,42 @@ class TikzPrinter : public LatexPrinter {
         m_body = Body{getTikzHeader(), "", getTikzFooter()};
     }
 
+    /**
+     * Scale the drawing so that box fits widthInCm by heightInCm. With keepAspectRatio both axes
+     * get the largest common scale that fits, otherwise each axis is scaled to its size on its
+     * own. An axis without extent takes the scale of the other one; an empty box gets scale 1.
+     */
+    void autoscale(const BoundingBox& box, double widthInCm, double heightInCm, bool keepAspectRatio = true) {
+        double scaleX = box.width() > 0 ? widthInCm / box.width() : 0,
+               scaleY = box.height() > 0 ? heightInCm / box.height() : 0;
+        if(keepAspectRatio)
+            scaleX = scaleY = scaleX > 0 && scaleY > 0 ? std::min(scaleX, scaleY) : std::max(scaleX, scaleY);
+        if(scaleX == 0)
+            scaleX = scaleY > 0 ? scaleY : 1;
+        if(scaleY == 0)
+            scaleY = scaleX;
+        _scaleX = scaleX;
+        _scaleY = scaleY;
+        _scaleFactor = m_autoscaleFactor = std::min(scaleX, scaleY);
+        _bounds = box;
+        if(_bounds.empty())
+            _bounds.add(0, 0);
+    }
+    /** The scale of each axis; a _scaleFactor assigned after autoscale() applies to both. */
+    double getScaleX() const {
+        return _scaleFactor != m_autoscaleFactor ? _scaleFactor : _scaleX;
+    }
+    double getScaleY() const {
+        return _scaleFactor != m_autoscaleFactor ? _scaleFactor : _scaleY;
+    }
+    void autoscale(const BoundingBox& box, double sizeInCm = 10.0) {
+        autoscale(box, sizeInCm, sizeInCm);
+    }
     void autoscale(double minX, double minY, double maxX, double maxY, double sizeInCm) {
-        double deltaX = std::abs( minX - maxX ),
-                deltaY = std::abs( minY - maxY ),
-                delta  = std::max( deltaX, deltaY );
-        _scaleFactor = sizeInCm / delta;
+        BoundingBox box;
+        box.add(minX, minY);
+        box.add(maxX, maxY);
+        autoscale(box, sizeInCm);
     }
 
     // begin and end are iterators over the point set that will be printed
@@ -39,19 +73,7 @@ class TikzPrinter : public LatexPrinter {
     template< class InputIterator>
     void autoscale( InputIterator pointsBegin, InputIterator pointsEnd, double sizeInCm = 10.0 )
     {
-        double minX = pointsBegin->x(),
-                maxX = minX,
-                minY = pointsBegin->y(),
-                maxY = minY;
-
-        for( auto p=pointsBegin; p!=pointsEnd; ++p )
-        {
-            minX = std::min( p->x(), minX );
-            maxX = std::max( p->x(), maxX );
-            minY = std::min( p->y(), minY );
-            maxY = std::max( p->y(), maxY );
-        }
-        autoscale(minX,minY, maxX,maxY, sizeInCm);
+        autoscale(BoundingBox::of(pointsBegin, pointsEnd), sizeInCm);
     }
 
     // Tikz getters
@@ -67,7 +89,63 @@ class TikzPrinter : public LatexPrinter {
         return "\\end{tikzpicture}\n\n";
     }
 protected:
-    double _scaleFactor = 1;
+    /** Append "(x,y)" to out using the printer's number format. */
+    void appendCoordinate(std::string& out, double x, double y) const {
+        out += '(';
+        appendNumber(out, x, m_numberFormat);
+        out += ',';
+        appendNumber(out, y, m_numberFormat);
+        out += ')';
+    }
+
+    typedef size_t StyleId;
+    /**
+     * Look up the style for an options list, registering it on first use. Each distinct list is
+     * expanded once into a \tikzset definition: in the body header while the printer is still
+     * in memory, or at the current position once the header has been streamed.
+     */
+    StyleId internStyle(const OptionsList& options) {
+        auto it = m_styleIds.find(options);
+        if(it != m_styleIds.end())
+            return it->second;
+
+        StyleId id = m_styleOptions.size();
+        m_styleIds.emplace(options, id);
+        m_styleOptions.push_back(options);
+        m_styleNames.push_back("s" + formatNumber(id));
+
+        std::string definition = "\\tikzset{" + m_styleNames.back()
+                               + "/.style={" + expandOptions(options) + "}}\n";
+        if(m_stream) {
+            addRawText(definition);
+        } else {
+            m_body.header += definition;
+        }
+        return id;
+    }
+    /** Append "[name]" for a style, or nothing for an empty options list. */
+    void appendStyle(std::string& out, const OptionsList& options, const std::string& prefix = "") {
+        if(options.empty() && prefix.empty())
+            return;
+        out += '[';
+        out += prefix;
+        if(!options.empty()) {
+            if(!prefix.empty())
+                out += ',';
+            out += m_styleNames[internStyle(options)];
+        }
+        out += "] ";
+    }
+
+    std::map<OptionsList,StyleId> m_styleIds;
+    std::vector<OptionsList> m_styleOptions;
+    std::vector<std::string> m_styleNames;
+
+    double _scaleX = 1;
+    double _scaleY = 1;
+    double _scaleFactor = 1; // the scale of both axes when the aspect ratio is kept, else the smaller one
+    double m_autoscaleFactor = 1; // _scaleFactor as set by autoscale, to tell when it was assigned since
+    BoundingBox _bounds; // extent of the point set given to autoscale
     double _resizeFactor = 1;
 }; // class TikzPrinter
 
@@ -0,0 +1,63 @@
+#ifndef CPPTEX_PARALLEL_H
+#define CPPTEX_PARALLEL_H
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace cpptex {
+
+/** The number of worker threads to use when 0 is requested. */
+inline unsigned defaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/** The number of chunks parallelFor splits [0,n) into. */
+inline size_t parallelChunkCount(size_t n, unsigned maxThreads = 0, size_t minChunk = 1) {
+    if(n == 0)
+        return 0;
+    size_t threads = maxThreads > 0 ? maxThreads : defaultThreadCount();
+    return std::max<size_t>(1, std::min(threads, (n + minChunk - 1) / std::max<size_t>(minChunk, 1)));
+}
+
+/**
+ * Split [0,n) into at most maxThreads contiguous chunks of at least minChunk indices and call
+ * f(begin, end, chunkIndex) for each chunk on its own thread. Chunks are numbered in order, so
+ * per-chunk results can be combined deterministically. With a single chunk f runs on the calling
+ * thread. The first exception thrown by a chunk is rethrown once all chunks have finished.
+ */
+template<class Function>
+void parallelFor(size_t n, Function f, unsigned maxThreads = 0, size_t minChunk = 1) {
+    if(n == 0)
+        return;
+    size_t threads = parallelChunkCount(n, maxThreads, minChunk);
+    if(threads == 1) {
+        f(size_t(0), n, size_t(0));
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(threads);
+    size_t chunk = (n + threads - 1) / threads;
+    for(size_t t=0; t<threads; ++t) {
+        size_t begin = std::min(n, t*chunk), end = std::min(n, begin + chunk);
+        workers.emplace_back([&f, &errors, begin, end, t] {
+            try {
+                f(begin, end, t);
+            } catch(...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for(auto& worker : workers)
+        worker.join();
+    for(const auto& error : errors) {
+        if(error)
+            std::rethrow_exception(error);
+    }
+}
+
+} // namespace cpptex
+
+#endif // CPPTEX_PARALLEL_H
@@ -2,10 +2,14 @@
 #define CPPTEX_UTIL_H
 
 #include <algorithm>
+#include <charconv>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <iomanip>
 #include <string>
+#include <type_traits>
 
 namespace cpptex {
 
@@ -14,18 +18,18 @@ const bool PRECOMPILE_SUBDOCUMENTS = true;
 const double PI = M_PI;
 
 // see https://stackoverflow.com/questions/5891610/how-to-remove-certain-characters-from-a-string-in-c
-std::string removeCharsFromString( std::string str, const char* charsToRemove ) {
+inline std::string removeCharsFromString( std::string str, const char* charsToRemove ) {
     for ( unsigned int i = 0; i < std::strlen(charsToRemove); ++i ) {
         str.erase( remove(str.begin(), str.end(), charsToRemove[i]), str.end() );
     }
     return str;
 }
-std::string removeSpaces(std::string str) {
+inline std::string removeSpaces(std::string str) {
     const char space = ' ';
     return removeCharsFromString(str,&space);
 }
 
-std::pair<std::string,std::string>
+inline std::pair<std::string,std::string>
 splitDirectoriesFromFilename(std::string path) {
     auto pos = path.rfind('/');
     return pos == std::string::npos ? // Just a file name
@@ -35,6 +39,92 @@ splitDirectoriesFromFilename(std::string path) {
 }
 
 
+/**
+ * How numbers are written into a document. A non-negative precision prints at most that many
+ * decimals with trailing zeros dropped, a negative precision prints the shortest text that
+ * reads back to the same double, which may take 17 digits. The default of 6 decimals is what
+ * std::to_string printed, less the padding. Exponent notation is never used, since TeX cannot
+ * parse it.
+ */
+struct NumberFormat {
+    int precision = 6;
+};
+
+/** Append an integer to out without going through a temporary string. */
+template<class Integer, typename std::enable_if<std::is_integral<Integer>::value,int>::type = 0>
+void appendNumber(std::string& out, Integer value, const NumberFormat& = {}) {
+    char buffer[24];
+    char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    out.append(buffer, end);
+}
+/** Append a double to out according to format, printing integral values without decimals. */
+inline void appendNumber(std::string& out, double value, const NumberFormat& format = {}) {
+    if(std::abs(value) < 1e15 && value == std::trunc(value)) {
+        appendNumber(out, static_cast<long long>(value));
+        return;
+    }
+    char buffer[512]; // fits every double in fixed notation
+    char* end = format.precision < 0
+        ? std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed).ptr
+        : std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, format.precision).ptr;
+
+    if(format.precision > 0) {
+        // drop the zero padding, and the decimal point if nothing is left behind it
+        while(*(end-1) == '0')
+            --end;
+        if(*(end-1) == '.')
+            --end;
+    }
+    // values rounded to zero lose their sign
+    if(end - buffer == 2 && buffer[0] == '-' && buffer[1] == '0') {
+        out += '0';
+        return;
+    }
+    out.append(buffer, end);
+}
+template<class Number>
+std::string formatNumber(Number value, const NumberFormat& format = {}) {
+    std::string text;
+    appendNumber(text, value, format);
+    return text;
+}
+
+/** Append text as a JSON string literal. */
+inline void appendJsonString(std::string& json, const std::string& text) {
+    json += '"';
+    for(char c : text) {
+        if(c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        } else if(static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            json += escaped;
+        } else {
+            json += c;
+        }
+    }
+    json += '"';
+}
+
+/** Incremental 64-bit FNV-1a hash, stable across runs and platforms. */
+struct Fnv1aHash {
+    uint64_t value = 0xcbf29ce484222325ULL;
+
+    void update(const char* data, size_t size) {
+        for(size_t i=0; i<size; ++i)
+            value = (value ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+    }
+    void update(const std::string& text) {
+        update(text.data(), text.size());
+    }
+    std::string hex() const {
+        char buffer[17];
+        snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+        return buffer;
+    }
+};
+
 struct SetPrecision {
     int value;
     std::string operator()(const std::string& val) const {
@@ -60,17 +150,17 @@ struct SetPrecision {
     }
 };
 
-std::string texttt(const std::string& input) {
+inline std::string texttt(const std::string& input) {
     return "\\texttt{" + input + "}";
 }
-std::string subsection(const std::string& input) {
+inline std::string subsection(const std::string& input) {
     return "\\subsection{" + input + "}";
 }
-std::string mathrm(const std::string& input) {
+inline std::string mathrm(const std::string& input) {
     return "\\mathrm{" + input + "}";
 }
 
-std::vector<size_t> parseHexRGB( const std::string& hex_str ) {
+inline std::vector<size_t> parseHexRGB( const std::string& hex_str ) {
     // the hex string should contain 6 digits
     // three 2-digit hex numbers
     std::vector<size_t> rgb(3, 0);